@@ -1,65 +1,472 @@
 #include "plugin.hpp"
 #include "widgets/schlappi_widgets.hpp"
+#include "dsp/resampler.hpp"
+#include "dsp/oversampling.hpp"
+#include "dsp/static_input.hpp"
+#include "dsp/block.hpp"
+#include "dsp/pipeline.hpp"
+#include "dsp/engines.hpp"
+#include "dsp/bus.hpp"
+#include "dsp/telemetry.hpp"
+#include "dsp/profiling.hpp"
 #include <cmath>
 #include <math.h>
 #include <array>
 #include <vector>
 
 #define NIBBLE 4
-#define BTFLD_UPSAMPLE_RATE 8
+// defaults, the context menu can pick another ratio and quality
+#define BTFLD_UPSAMPLE_RATIO 8
 #define BTFLD_UPSAMPLE_QUALITY 12
+// how long the quantized input has to stay on an odd value before a bit goes high, 1.5 samples at 48 kHz
+#define BTFLD_BIT_DEBOUNCE_TIME (1.5f / 48000.f)
 
+template <typename T = float>
 struct ACCouplingFilter {
-    ACCouplingFilter() : xPrev(0), yPrev(0), scalar(0) {}
+    ACCouplingFilter() : xPrev(0.f), yPrev(0.f), scalar(0) {}
 
     void setDecay(float halflife) {
         scalar = std::pow(2, -1.f / halflife);
     }
 
-    float process(float x) {
-        auto y = scalar * (x + yPrev - xPrev);
+    T process(T x) {
+        T y = scalar * (x + yPrev - xPrev);
         yPrev = y;
         xPrev = x;
         return y;
     }
 public:
-    float xPrev, yPrev, scalar;
+    T xPrev, yPrev;
+    float scalar;
 };
 
-struct BitCalculator {
-    int stepSize;
-    int delayBeforeGoingHigh = BTFLD_UPSAMPLE_RATE * 1.5f;
-    int counter;
-    int lastOddValue;
+// Debounced bits of the quantized signal for four channels at once. A bit only goes high once the quantized value,
+// shifted down to that bit, has sat on the same odd value for delayBeforeGoingHigh subsamples, which suppresses glitches
+// at step boundaries. All four bits are updated from one quantized value per subsample.
+struct BitDebouncer {
+    // set from BTFLD_BIT_DEBOUNCE_TIME by the engine
+    int delayBeforeGoingHigh = 1;
+    std::array<float_4, NIBBLE> counter;
+    std::array<float_4, NIBBLE> lastOddValue;
 
-    BitCalculator() {
-        counter = 0;
-        lastOddValue = 0;
+    BitDebouncer() {
+        for (auto b = 0; b < NIBBLE; ++b) {
+            counter[b] = 0.f;
+            lastOddValue[b] = 0.f;
+        }
     }
 
-    bool oddTracker(int input) {
-        if ((input % 2) == 0) {
-            counter = 0;
-            return false;
+    /** `quantized` is floor() of a non-negative input, `bits` receives 0 or 1 per bit */
+    void process(float_4 quantized, std::array<float_4, NIBBLE>& bits) {
+        float_4 delay = static_cast<float>(delayBeforeGoingHigh);
+        float_4 value = quantized;
+        for (auto b = 0; b < NIBBLE; ++b) {
+            // halving an integer valued float and flooring it is exact, so this is floor(input / 2^(b + 1))
+            float_4 next = simd::floor(value * 0.5f);
+            float_4 odd = (value - 2.f * next) == 1.f;
+            float_4 changed = value != lastOddValue[b];
+
+            counter[b] = simd::ifelse(changed, 1.f, simd::fmin(counter[b] + 1.f, delay));
+            counter[b] = simd::ifelse(odd, counter[b], 0.f);
+            lastOddValue[b] = simd::ifelse(odd, value, lastOddValue[b]);
+            bits[b] = simd::ifelse(odd & (counter[b] >= delay), 1.f, 0.f);
+            value = next;
         }
+    }
+};
+
+// Converter resolutions the engines are compiled for, the default is the 4 bits of the hardware
+static const int BTFLD_RESOLUTIONS[] = {4, 6, 8};
+#define BTFLD_NUM_RESOLUTIONS (sizeof(BTFLD_RESOLUTIONS) / sizeof(BTFLD_RESOLUTIONS[0]))
+
+// Quantizer of a BITS bit converter over the 10V input range. The bit outputs are always its four most significant
+// bits, more bits make the staircase finer and the saw faster.
+template <int BITS>
+struct BtfldQuantizer {
+    static_assert(BITS >= NIBBLE && BITS <= 8, "BTFLD converters have 4 to 8 bits");
+    static constexpr int LEVELS = 1 << BITS;
+    // steps per volt
+    static constexpr float SCALE = LEVELS / 10.f;
+    // the quantized input stops at the top step, what is above it comes out at the step output
+    static constexpr float TOP = LEVELS - 0.01f;
+    // steps per value of the bit outputs
+    static constexpr float COARSE = LEVELS / 16.f;
+};
+
+// input, gain and inject in; bits, steps and saw out
+typedef FrameBlock<3, NIBBLE + 2> BtfldBlock;
+
+// Converter state for one group of four polyphony channels. The oversampled part lives in BtfldOversampledEngine so
+// that the ratio and filter quality can be chosen at runtime while the inner loops stay specialized.
+struct BtfldEngine {
+    BitDebouncer bitDebouncer;
+
+    ACCouplingFilter<float_4> stepFilter;
+    ACCouplingFilter<float_4> sawFilter;
+
+    // decimated outputs of the last process() call, bits are 0..1 and steps are 0..2^BITS
+    std::array<float_4, NIBBLE> bits;
+    float_4 steps;
+    float_4 saw;
+    float_4 feedback;
+    // debounced bits of the last frame's subsamples, getRatio() of them, for the expander bus
+    BusGroup busStates;
 
-        if (input != lastOddValue) {
-            lastOddValue = input;
-            counter = 1;
-        } else if (counter < delayBeforeGoingHigh) {
-            ++counter;
+    BtfldEngine() {
+        for (auto b = 0; b < NIBBLE; ++b) {
+            bits[b] = 0.f;
         }
-        return counter >= delayBeforeGoingHigh;
+        steps = 0.f; saw = 0.f; feedback = 0.f;
+    }
+
+    virtual ~BtfldEngine() {}
+
+    virtual int getRatio() = 0;
+
+    // size of the whole engine, for the per-instance memory budget
+    virtual size_t stateBytes() = 0;
+
+    virtual void setSampleRate(float sampleRate) {
+        stepFilter.setDecay(0.25f * sampleRate);
+        sawFilter.setDecay(0.25f * sampleRate);
+
+        auto delay = std::max(1, static_cast<int>(std::round(BTFLD_BIT_DEBOUNCE_TIME * sampleRate * getRatio())));
+        bitDebouncer.delayBeforeGoingHigh = delay;
     }
 
-    float process(float input) {
-        if (oddTracker(static_cast<int>(input) / stepSize)) {
-            return static_cast<float>(1.f);
+    static float_4 saturate(float_4 x) {
+        return simd::fmin(simd::fmax(0.f, x), 11.7f);
+    }
+
+    virtual void process(float_4 input, float_4 gain, float_4 inject, bool bipolar) = 0;
+
+    // Processes a full block in place. Engines without a block path run process() once per frame.
+    virtual void processBlock(BtfldBlock& block, int frames, bool bipolar) {
+        for (auto f = 0; f < frames; ++f) {
+            process(block.inputs[0][f], block.inputs[1][f], block.inputs[2][f], bipolar);
+            storeOutputs(block, f);
         }
-        return 0.f;
+    }
+
+    // the outputs of the last processed frame, in BtfldBlock order
+    void getOutputs(std::array<float_4, NIBBLE + 2>& out) const {
+        for (auto b = 0; b < NIBBLE; ++b) {
+            out[b] = bits[b];
+        }
+        out[NIBBLE] = steps;
+        out[NIBBLE + 1] = saw;
+    }
+
+    void storeOutputs(BtfldBlock& block, int f) const {
+        for (auto b = 0; b < NIBBLE; ++b) {
+            block.outputs[b][f] = bits[b];
+        }
+        block.outputs[NIBBLE][f] = steps;
+        block.outputs[NIBBLE + 1][f] = saw;
     }
 };
 
+// Upsamples input, gain and inject, runs the quantizer sweep over every subsample and decimates bits, steps and saw,
+// see OversampledPipeline. Per-sample processing is a chunk of one frame.
+template <int BITS, int RATIO, int QUALITY>
+struct BtfldOversampledEngine : BtfldEngine {
+    typedef BtfldQuantizer<BITS> Quantizer;
+    typedef OversampledPipeline<RATIO, QUALITY, 3, NIBBLE + 2> Pipeline;
+
+    Pipeline pipeline{0.5f, true};
+    // range of the frames being processed, a change restarts the static input check
+    bool bipolarRange = false;
+
+    int getRatio() override {
+        return RATIO;
+    }
+
+    size_t stateBytes() override {
+        return sizeof(*this);
+    }
+
+    void setSampleRate(float sampleRate) override {
+        BtfldEngine::setSampleRate(sampleRate);
+        // upsampler history, the bit debounce plus one sample, decimator history
+        auto debounceFrames = (bitDebouncer.delayBeforeGoingHigh + RATIO - 1) / RATIO;
+        pipeline.staticInputs.settleFrames = 2 * QUALITY + debounceFrames + 1;
+        pipeline.staticInputs.reset();
+    }
+
+    void setBipolar(bool bipolar) {
+        if (bipolar != bipolarRange) {
+            bipolarRange = bipolar;
+            pipeline.staticInputs.reset();
+        }
+    }
+
+    typename Pipeline::Outputs heldOutputs() {
+        return {{&bits[0], &bits[1], &bits[2], &bits[3], &steps, &saw}};
+    }
+
+    void process(float_4 input, float_4 gain, float_4 inject, bool bipolar) override {
+        setBipolar(bipolar);
+        pipeline.process({{input, gain, inject}}, *this, heldOutputs());
+    }
+
+    void processBlock(BtfldBlock& block, int frames, bool bipolar) override {
+        setBipolar(bipolar);
+        pipeline.processBlock(block, frames, *this, heldOutputs());
+    }
+
+    bool upsampleInputs() const {
+        return true;
+    }
+
+    void staticCheck(typename Pipeline::Frame& check) const {
+    }
+
+    int chunkFrames() const {
+        return BLOCK_CHUNK_FRAMES;
+    }
+
+    // One sweep computes all six decimator inputs from input, gain and inject, each subsample is quantized once
+    void processSubsamples(const typename Pipeline::Inputs& in, int frames,
+                           const std::array<float_4*, 3>& upsampled, const typename Pipeline::Outputs& out) {
+        float_4* upsampledInput = upsampled[0];
+        const float_4* upsampledCV = upsampled[1];
+        const float_4* upsampledInject = upsampled[2];
+        float_4* upsampledStepOut = out[NIBBLE];
+        float_4* upsampledSaw = out[NIBBLE + 1];
+
+        std::array<float_4, NIBBLE> subsampleBits;
+        for (auto ss = 0; ss < frames * RATIO; ++ss) {
+            upsampledInput[ss] *= upsampledCV[ss];
+            upsampledInput[ss] += bipolarRange ? 5.f : 0.f;
+            upsampledInput[ss] += upsampledInject[ss];
+
+            upsampledInput[ss] = saturate(upsampledInput[ss]);
+
+            upsampledInput[ss] *= Quantizer::SCALE;
+
+            upsampledStepOut[ss] = simd::fmax(upsampledInput[ss] - Quantizer::TOP, 0.f);
+            upsampledInput[ss] = simd::fmin(upsampledInput[ss], Quantizer::TOP);
+
+            float_4 quantized = simd::floor(upsampledInput[ss]);
+            upsampledStepOut[ss] += quantized;
+            upsampledSaw[ss] = simd::fmin(simd::fmax(0.f, upsampledInput[ss] - upsampledStepOut[ss]), 1.1f);
+
+            // the bit outputs debounce the four most significant bits, dividing by a power of two is exact
+            bitDebouncer.process(BITS > NIBBLE ? simd::floor(quantized * (1.f / Quantizer::COARSE)) : quantized,
+                                 subsampleBits);
+            for (auto b = 0; b < NIBBLE; ++b) {
+                out[b][ss] = subsampleBits[b];
+            }
+        }
+        for (auto b = 0; b < NIBBLE; ++b) {
+            packBusStates<RATIO>(&out[b][(frames - 1) * RATIO], busStates.states[b]);
+        }
+    }
+};
+
+// The staircase, saw and bit outputs of a BITS bit converter as functions of the summed input x, before saturation, and
+// their antiderivatives over x. With L = 2^BITS levels, u = L / 10 * clamp(x, 0, 11.7) and C = L / 16:
+//   step(u) = floor(u) below L - 0.01, above that it rises with u
+//   saw(u)  = u - floor(u) below L - 0.01, above that it falls to 0 at L + 0.98
+//   bit b   = bit b of floor(min(u, L - 0.01) / C)
+// All of them are 0 below x = 0 and constant above x = 11.7.
+template <int BITS>
+struct BtfldTransfer {
+    // bits, step, saw
+    static const int NUM_OUTPUTS = NIBBLE + 2;
+    typedef std::array<double, NUM_OUTPUTS> Values;
+
+    static constexpr double LEVELS = 1 << BITS;
+    static constexpr double SCALE = LEVELS / 10.;
+    static constexpr double TOP = LEVELS - 0.01;
+    static constexpr double COARSE = LEVELS / 16.;
+
+    static void evaluate(double x, Values& y) {
+        double u = std::min(std::max(x, 0.), 11.7) * SCALE;
+        double uq = std::min(u, TOP);
+        double n = std::floor(uq);
+        double above = u - uq;
+        int coarse = static_cast<int>(std::floor(uq / COARSE));
+        for (auto b = 0; b < NIBBLE; ++b) {
+            y[b] = coarse & (1 << b) ? 1. : 0.;
+        }
+        y[NIBBLE] = n + above;
+        y[NIBBLE + 1] = above > 0. ? std::max(0.99 - above, 0.) : uq - n;
+    }
+
+    static void antiderivatives(double x, Values& y) {
+        double u = std::min(std::max(x, 0.), 11.7) * SCALE;
+        double uq = std::min(u, TOP);
+        double n = std::floor(uq);
+        double f = uq - n;
+        double above = u - uq;
+        // the bits are functions of v = uq / C, integrated over v and scaled back to u
+        double v = uq / COARSE;
+        for (auto b = 0; b < NIBBLE; ++b) {
+            double half = 1 << b;
+            double period = 2. * half;
+            double high = std::floor(v / period) * half + std::max(std::fmod(v, period) - half, 0.);
+            // all bits are high above the top step
+            y[b] = COARSE * high + above;
+        }
+        y[NIBBLE] = n * (n - 1.) * 0.5 + n * f + (LEVELS - 1.) * above + above * above * 0.5;
+        double falling = std::min(above, 0.99);
+        y[NIBBLE + 1] = n * 0.5 + f * f * 0.5 + 0.99 * falling - falling * falling * 0.5;
+
+        // from u back to x, and continue linearly past the saturation point
+        double saturated = std::max(x - 11.7, 0.);
+        for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+            y[o] *= (1. / SCALE);
+        }
+        for (auto b = 0; b < NIBBLE; ++b) {
+            y[b] += saturated;
+        }
+        y[NIBBLE] += (11.7 * SCALE - 0.99) * saturated;
+    }
+};
+
+// Evaluates the BTFLD transfer functions with first order antiderivative anti-aliasing instead of running them at a
+// high oversampling ratio. RATIO is 1 or 2, QUALITY only matters for the 2x resamplers. The bit debounce is not used:
+// its job was to hide glitches of the oversampled staircase, which ADAA does not produce.
+template <int BITS, int RATIO, int QUALITY>
+struct BtfldAdaaEngine : BtfldEngine {
+    typedef BtfldTransfer<BITS> Transfer;
+    typedef typename Transfer::Values Values;
+
+    // input, gain and inject
+    PolyUpsamplerBank<RATIO, QUALITY, 3> upsamplers{0.5f};
+
+    std::array<float_4, RATIO> upsampledInput;
+    std::array<float_4, RATIO> upsampledCV;
+    std::array<float_4, RATIO> upsampledInject;
+    std::array<std::array<float_4, RATIO>, Transfer::NUM_OUTPUTS> upsampledOutputs;
+    PolyDecimatorBank<RATIO, QUALITY, Transfer::NUM_OUTPUTS> downsamplers;
+
+    // last input and antiderivatives per channel
+    std::array<double, 4> previousX;
+    std::array<Values, 4> previousIntegrals;
+
+    StaticInputDetector<3> staticInputs;
+    bool previousBipolar = false;
+
+    BtfldAdaaEngine() {
+        for (auto c = 0; c < 4; ++c) {
+            previousX[c] = 0.;
+            Transfer::antiderivatives(0., previousIntegrals[c]);
+        }
+        // resampler histories, one sample for the ADAA state
+        staticInputs.settleFrames = (RATIO > 1 ? 2 * QUALITY : 0) + 1;
+    }
+
+    int getRatio() override {
+        return RATIO;
+    }
+
+    size_t stateBytes() override {
+        return sizeof(*this);
+    }
+
+    void process(float_4 input, float_4 gain, float_4 inject, bool bipolar) override {
+        if (bipolar != previousBipolar) {
+            previousBipolar = bipolar;
+            staticInputs.reset();
+        }
+        std::array<float_4, 3> staticCheck = {{input, gain, inject}};
+        if (staticInputs.process(staticCheck)) {
+            return;
+        }
+
+        PROFILE_START();
+        if (RATIO > 1) {
+            upsamplers.process({{&input, &gain, &inject}}, 1,
+                               {{upsampledInput.data(), upsampledCV.data(), upsampledInject.data()}});
+        } else {
+            upsampledCV[0] = gain;
+            upsampledInput[0] = input;
+            upsampledInject[0] = inject;
+        }
+        PROFILE_LAP(PROFILE_UPSAMPLE);
+
+        for (auto ss = 0; ss < RATIO; ++ss) {
+            float_4 x = upsampledInput[ss] * upsampledCV[ss] + (bipolar ? 5.f : 0.f) + upsampledInject[ss];
+            for (auto c = 0; c < 4; ++c) {
+                Values y;
+                adaa(c, x[c], y);
+                for (auto o = 0; o < Transfer::NUM_OUTPUTS; ++o) {
+                    upsampledOutputs[o][ss][c] = y[o];
+                }
+            }
+        }
+        for (auto b = 0; b < NIBBLE; ++b) {
+            packBusStates<RATIO>(upsampledOutputs[b].data(), busStates.states[b]);
+        }
+        PROFILE_LAP(PROFILE_CORE);
+
+        std::array<float_4, Transfer::NUM_OUTPUTS> out;
+        for (auto o = 0; o < Transfer::NUM_OUTPUTS; ++o) {
+            out[o] = upsampledOutputs[o][0];
+        }
+        if (RATIO > 1) {
+            std::array<const float_4*, Transfer::NUM_OUTPUTS> decimatorIn;
+            std::array<float_4*, Transfer::NUM_OUTPUTS> decimatorOut;
+            for (auto o = 0; o < Transfer::NUM_OUTPUTS; ++o) {
+                decimatorIn[o] = upsampledOutputs[o].data();
+                decimatorOut[o] = &out[o];
+            }
+            downsamplers.process(decimatorIn, 1, decimatorOut);
+        }
+        PROFILE_LAP(PROFILE_OUTPUT);
+        for (auto b = 0; b < NIBBLE; ++b) {
+            bits[b] = out[b];
+        }
+        steps = out[NIBBLE];
+        saw = out[NIBBLE + 1];
+    }
+
+    // First order ADAA: the average of each transfer function over the segment from the previous input to this one
+    void adaa(int c, double x, Values& y) {
+        Values integrals;
+        Transfer::antiderivatives(x, integrals);
+        double dx = x - previousX[c];
+        if (std::abs(dx) > 1e-5) {
+            for (auto o = 0; o < Transfer::NUM_OUTPUTS; ++o) {
+                y[o] = (integrals[o] - previousIntegrals[c][o]) / dx;
+            }
+        } else {
+            // ill-conditioned, the segment is short enough to use its midpoint
+            Transfer::evaluate(0.5 * (x + previousX[c]), y);
+        }
+        previousX[c] = x;
+        previousIntegrals[c] = integrals;
+    }
+};
+
+// The engines of one resolution, with the ratio and quality left to the oversampling factories
+template <int BITS>
+struct BtfldEngines {
+    template <int RATIO, int QUALITY>
+    using Oversampled = BtfldOversampledEngine<BITS, RATIO, QUALITY>;
+    template <int RATIO, int QUALITY>
+    using Adaa = BtfldAdaaEngine<BITS, RATIO, QUALITY>;
+};
+
+// The settings BTFLD engines are built for, changing any of them takes new engines
+struct BtfldEngineConfig {
+    int engineType = 0;
+    int resolution = 0;
+    int ratio = 0;
+    int quality = 0;
+    float sampleRate = 0.f;
+    int blockSize = 0;
+
+    bool operator==(const BtfldEngineConfig& other) const {
+        return engineType == other.engineType && resolution == other.resolution && ratio == other.ratio &&
+               quality == other.quality && sampleRate == other.sampleRate && blockSize == other.blockSize;
+    }
+};
+
+typedef EngineSet<BtfldEngine, BtfldBlock, BtfldEngineConfig> BtfldEngineSet;
+
 struct Btfld : Module {
 	enum ParamId {
 		GAIN_PARAM,
@@ -90,34 +497,39 @@ struct Btfld : Module {
 		LIGHTS_LEN
 	};
 
-    float feedback;
-    float previousInputSignal;
-    int previousSteps;
-    std::array<float, NIBBLE> bits;
-    std::array<float, NIBBLE> bitFilter;
-    const int OVERSAMPLING = 512;
-
-    ACCouplingFilter stepFilter;
-    ACCouplingFilter sawFilter;
-
-    dsp::Upsampler<BTFLD_UPSAMPLE_RATE, BTFLD_UPSAMPLE_QUALITY> inputUpsampler{0.5f};
-    dsp::Upsampler<BTFLD_UPSAMPLE_RATE, BTFLD_UPSAMPLE_QUALITY> cvUpsampler{0.5f};
-    dsp::Upsampler<BTFLD_UPSAMPLE_RATE, BTFLD_UPSAMPLE_QUALITY> injectUpsampler{0.5f};
-
-    std::array<float, BTFLD_UPSAMPLE_RATE> upsampledInput;
-    std::array<float, BTFLD_UPSAMPLE_RATE> upsampledCV;
-    std::array<float, BTFLD_UPSAMPLE_RATE> upsampledInject;
-    std::array<float, BTFLD_UPSAMPLE_RATE> workingBuffer;
-    std::array<float, BTFLD_UPSAMPLE_RATE> upsampledStepOut;
-    std::array<float, BTFLD_UPSAMPLE_RATE> upsampledSaw;
-
-    std::array<dsp::Decimator<BTFLD_UPSAMPLE_RATE, BTFLD_UPSAMPLE_QUALITY>, 4> downsamplers;
-    dsp::Decimator<BTFLD_UPSAMPLE_RATE, BTFLD_UPSAMPLE_QUALITY> stepDownsampler;
-    dsp::Decimator<BTFLD_UPSAMPLE_RATE, BTFLD_UPSAMPLE_QUALITY> sawDownsampler;
-
-    std::array<BitCalculator, NIBBLE> bitCalculators;
-
-    float upsamplerGain, downsamplerGain;
+    enum EngineType {
+        OVERSAMPLED_ENGINE,
+        ADAA_ENGINE,
+        ADAA_2X_ENGINE
+    };
+
+    OversamplingSettings oversampling{BTFLD_UPSAMPLE_QUALITY};
+    BlockSettings blockProcessing;
+    BitHistorySettings bitHistorySettings;
+
+    // lights and the bit history run at control rate
+    dsp::ClockDivider lightDivider;
+    BitHistory bitHistory;
+
+    // the bit streams for a BTMX or Nibbler on the right
+    std::array<BusMessage, 2> busMessages;
+
+#ifdef SCHLAPPI_PROFILE
+    ModuleProfile profile;
+#endif
+#ifdef SCHLAPPI_LOW_COST
+    // one ADAA pass per sample costs a fraction of even 4x oversampling
+    static const int DEFAULT_ENGINE = ADAA_ENGINE;
+#else
+    static const int DEFAULT_ENGINE = OVERSAMPLED_ENGINE;
+#endif
+    int engineType = DEFAULT_ENGINE;
+    // bits of the converter, one of BTFLD_RESOLUTIONS
+    int resolution = NIBBLE;
+    float sampleRate = OVERSAMPLING_REFERENCE_RATE;
+
+    // one engine per group of four polyphony channels and the frame blocks of block mode
+    EngineHandoff<BtfldEngineSet> engineSets;
 
 	Btfld() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -134,37 +546,89 @@ struct Btfld : Module {
         configOutput(BIT_OUTPUT, "Out bit 1");
         configOutput(STEP_OUT_OUTPUT, "Step");
 
-        std::fill(workingBuffer.begin(), workingBuffer.end(), 0.f);
+        initBusProducer(this, busMessages);
+        lightDivider.setDivision(TELEMETRY_DIVISION);
+        updateEngines();
+    }
 
-        feedback = 0; previousSteps = 0; previousInputSignal = 0;
+    // Builds new engines when the engine type, the resolution, the sample rate, the oversampling settings or block
+    // processing change. Called where those change, never from process(), which switches to the new engines through
+    // engineSets.
+    void updateEngines() {
+        BtfldEngineConfig config;
+        config.engineType = engineType;
+        config.resolution = resolution;
+        config.ratio = oversampling.resolveRatio(sampleRate, BTFLD_UPSAMPLE_RATIO);
+        config.quality = oversampling.quality;
+        config.sampleRate = sampleRate;
+        config.blockSize = blockProcessing.size;
+        engineSets.update(config, [](const BtfldEngineConfig& config) {
+            auto set = new BtfldEngineSet(config);
+            for (auto& engine : set->engines) {
+                if (config.resolution == 8) {
+                    engine.reset(createEngine<8>(config));
+                } else if (config.resolution == 6) {
+                    engine.reset(createEngine<6>(config));
+                } else {
+                    engine.reset(createEngine<4>(config));
+                }
+                engine->setSampleRate(config.sampleRate);
+            }
+            return set;
+        });
+    }
 
-        float kernelSum = 0;
-        for (auto i = 0; i < BTFLD_UPSAMPLE_RATE * BTFLD_UPSAMPLE_QUALITY; ++i) {
-            kernelSum += cvUpsampler.kernel[i];
-        }
-        upsamplerGain = 1.f / kernelSum;
-        kernelSum = 0;
-        for (auto i = 0; i < BTFLD_UPSAMPLE_RATE * BTFLD_UPSAMPLE_QUALITY; ++i) {
-            kernelSum += downsamplers[0].kernel[i];
+    template <int BITS>
+    static BtfldEngine* createEngine(const BtfldEngineConfig& config) {
+        if (config.engineType == ADAA_ENGINE) {
+            return createEngineWithQuality<1, BtfldEngine, BtfldEngines<BITS>::template Adaa>(config.quality);
+        } else if (config.engineType == ADAA_2X_ENGINE) {
+            return createEngineWithQuality<2, BtfldEngine, BtfldEngines<BITS>::template Adaa>(config.quality);
         }
-        downsamplerGain = 1.f / kernelSum;
+        return createOversampledEngine<BtfldEngine, BtfldEngines<BITS>::template Oversampled>(config.ratio,
+                                                                                              config.quality);
+    }
+
+    // steps of the staircase of the engines process() runs on
+    float getLevels() const {
+        return static_cast<float>(1 << engineSets.current->config.resolution);
+    }
 
-        bitCalculators[0].stepSize = 1;
-        bitCalculators[1].stepSize = 2;
-        bitCalculators[2].stepSize = 4;
-        bitCalculators[3].stepSize = 8;
+    // Memory held by this instance: the module, its engines and the frame blocks of block mode. The chunk buffers are
+    // shared per thread and not counted.
+    size_t stateBytes() {
+        return sizeof(*this) + engineSets.current->stateBytes();
     }
 
     void onSampleRateChange(const SampleRateChangeEvent& e) override {
-        stepFilter.setDecay(0.25f * e.sampleRate);
-        sawFilter.setDecay(0.25f * e.sampleRate);
+        sampleRate = e.sampleRate;
+        updateEngines();
+    }
 
-        for (auto& b : bits) { b = 0; }
-        for (auto& b : bitFilter) { b = 0; }
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        oversampling.toJson(rootJ);
+        blockProcessing.toJson(rootJ);
+        bitHistorySettings.toJson(rootJ);
+        json_object_set_new(rootJ, "engine", json_integer(engineType));
+        json_object_set_new(rootJ, "resolution", json_integer(resolution));
+        return rootJ;
     }
 
-    float saturate(float x) {
-        return std::min(std::max(0.f, x), 11.7f);
+    void dataFromJson(json_t* rootJ) override {
+        oversampling.fromJson(rootJ);
+        blockProcessing.fromJson(rootJ);
+        bitHistorySettings.fromJson(rootJ);
+        json_t* engineJ = json_object_get(rootJ, "engine");
+        if (engineJ) {
+            engineType = clamp(static_cast<int>(json_integer_value(engineJ)), 0, ADAA_2X_ENGINE);
+        }
+        json_t* resolutionJ = json_object_get(rootJ, "resolution");
+        if (resolutionJ) {
+            int bits = json_integer_value(resolutionJ);
+            resolution = (bits == 6 || bits == 8) ? bits : NIBBLE;
+        }
+        updateEngines();
     }
 
     void setPosNegLight(int light, float voltage, float sampleTime) {
@@ -174,59 +638,106 @@ struct Btfld : Module {
     }
 
     void process(const ProcessArgs& args) override {
-        auto cvInput = inputs[CV_INPUT].isConnected() ? inputs[CV_INPUT].getVoltage() : feedback;
-        auto gain = params[GAIN_PARAM].getValue() + params[CV_PARAM].getValue() * cvInput * 0.1f;
-
-        cvUpsampler.process(gain * upsamplerGain, upsampledCV.data());
-
-        setPosNegLight(CV_INDICATOR_LIGHT, params[CV_PARAM].getValue() * cvInput, args.sampleTime);
-
-
-        auto inputSignal = inputs[INPUT_INPUT].getVoltage();
+        PROFILE_FRAME(profile);
+        auto& engineSet = engineSets.acquire();
+        auto& engines = engineSet.engines;
+        int blockSize = engineSet.config.blockSize;
+
+        int channels = std::max({1,
+                                 inputs[INPUT_INPUT].getChannels(),
+                                 inputs[CV_INPUT].getChannels(),
+                                 inputs[INJECT_INPUT].getChannels()});
         auto bipolar = params[RANGE_PARAM].getValue() > 0.5f;
-        setPosNegLight(INPUT_INDICATOR_LIGHT, inputSignal, args.sampleTime);
-
-
-        inputUpsampler.process(inputSignal * upsamplerGain, upsampledInput.data());
-
-        auto inject = inputs[INJECT_INPUT].getVoltage();
-        setPosNegLight(INJECT_INDICATOR_LIGHT, inject, args.sampleTime);
-
-        injectUpsampler.process(inject * upsamplerGain, upsampledInject.data());
-
-        for (auto ss = 0; ss < BTFLD_UPSAMPLE_RATE; ++ss) {
-            upsampledInput[ss] *= upsampledCV[ss];
-            upsampledInput[ss] += bipolar ? 5.f : 0.f;
-            upsampledInput[ss] += upsampledInject[ss];
-
-            upsampledInput[ss] = saturate(upsampledInput[ss]);
-
-            upsampledInput[ss] *= (16.f / 10.f);
+        auto cvConnected = inputs[CV_INPUT].isConnected();
+        // first channel voltages for the indicator lights
+        float cvIndicator = 0.f, inputIndicator = 0.f, injectIndicator = 0.f;
+        BusMessage* busOut = busProducerMessage(this);
+
+        for (auto c = 0; c < channels; c += 4) {
+            auto& engine = *engines[c / 4];
+
+            float_4 cvInput = cvConnected ? inputs[CV_INPUT].getPolyVoltageSimd<float_4>(c) : engine.feedback;
+            float_4 gain = params[GAIN_PARAM].getValue() + params[CV_PARAM].getValue() * cvInput * 0.1f;
+            float_4 inputSignal = inputs[INPUT_INPUT].getPolyVoltageSimd<float_4>(c);
+            float_4 inject = inputs[INJECT_INPUT].getPolyVoltageSimd<float_4>(c);
+
+            // in block mode the outputs lag by blockSize frames, and so does the saw feedback into the gain
+            std::array<float_4, NIBBLE + 2> out;
+            if (blockSize > 0) {
+                std::array<float_4, 3> in = {{inputSignal, gain, inject}};
+                auto& frameBlock = (*engineSet.frameBlocks)[c / 4];
+                if (frameBlock.push(in, out, blockSize)) {
+                    engine.processBlock(frameBlock, blockSize, bipolar);
+                }
+            } else {
+                engine.process(inputSignal, gain, inject, bipolar);
+                engine.getOutputs(out);
+            }
 
+            if (busOut) {
+                if (blockSize > 0) {
+                    // the engine has run ahead of the delayed outputs, send those one state per frame
+                    for (auto b = 0; b < NIBBLE; ++b) {
+                        packBusStates<1>(&out[b], busOut->groups[c / 4].states[b]);
+                    }
+                } else {
+                    busOut->groups[c / 4] = engine.busStates;
+                }
+            }
 
-            upsampledStepOut[ss] = std::max(upsampledInput[ss] - 15.99f, 0.f);
-            upsampledInput[ss] = std::min(upsampledInput[ss], 15.99f);
+            for (auto i = 0; i < NIBBLE; ++i) {
+                outputs[BIT_OUTPUT + i].setVoltageSimd(out[i] * 10.f - (bipolar ? 5.f : 0.f), c);
+            }
 
-            upsampledStepOut[ss] += std::floor(upsampledInput[ss]);
-            upsampledSaw[ss] = std::min(std::max(0.f, upsampledInput[ss] - upsampledStepOut[ss]), 1.1f);
+            float_4 saw = out[NIBBLE + 1] * 10.f;
+            float_4 rescaledSteps = out[NIBBLE] * (10.f / getLevels());
+            float_4 filteredSteps = engine.stepFilter.process(rescaledSteps);
+            outputs[STEP_OUT_OUTPUT].setVoltageSimd(bipolar ? filteredSteps : rescaledSteps, c);
+            float_4 filteredSaw = engine.sawFilter.process(saw);
+            engine.feedback = simd::fmin(simd::fmax(-12.f, (bipolar ? filteredSaw : saw)), 12.f);
+            outputs[SAW_OUTPUT].setVoltageSimd(engine.feedback, c);
+
+            if (c == 0) {
+                cvIndicator = params[CV_PARAM].getValue() * cvInput[0];
+                inputIndicator = inputSignal[0];
+                injectIndicator = inject[0];
+            }
         }
 
+        for (auto o = 0; o < OUTPUTS_LEN; ++o) {
+            outputs[o].setChannels(channels);
+        }
 
+        if (busOut) {
+            busOut->ratio = blockSize > 0 ? 1 : engines[0]->getRatio();
+            busOut->channels = channels;
+            rightExpander.requestMessageFlip();
+        }
 
-        for (auto b = 0; b < NIBBLE; ++b) {
-            for (int ss = 0; ss < BTFLD_UPSAMPLE_RATE; ++ss) {
-                workingBuffer[ss] = bitCalculators[b].process(upsampledInput[ss]);
-            }
-            bits[b] = downsamplers[b].process(workingBuffer.data()) * downsamplerGain;
+        if (lightDivider.process()) {
+            PROFILE_START();
+            updateLights(args.sampleTime * lightDivider.getDivision(), bipolar, cvIndicator, inputIndicator,
+                         injectIndicator);
+            PROFILE_LAP(PROFILE_LIGHTS);
         }
+    }
+
+    // lights and the bit history follow the first channel
+    void updateLights(float lightTime, bool bipolar, float cvIndicator, float inputIndicator, float injectIndicator) {
+        setPosNegLight(CV_INDICATOR_LIGHT, cvIndicator, lightTime);
+        setPosNegLight(INPUT_INDICATOR_LIGHT, inputIndicator, lightTime);
+        setPosNegLight(INJECT_INDICATOR_LIGHT, injectIndicator, lightTime);
 
+        auto& first = *engineSets.current->engines[0];
+        int bits = 0;
         for (auto i = 0; i < NIBBLE; ++i) {
-            outputs[BIT_OUTPUT + i].setVoltage(bits[i] * 10.f - (bipolar ? 5.f : 0.f));
-            lights[BIT_INDICATOR_LIGHT + i].setBrightnessSmooth(bits[i], args.sampleTime);
+            lights[BIT_INDICATOR_LIGHT + i].setBrightnessSmooth(first.bits[i][0], lightTime);
+            bits |= first.bits[i][0] > 0.5f ? 1 << i : 0;
         }
 
-        float steps = stepDownsampler.process(upsampledStepOut.data()) * downsamplerGain;
-        float saw = sawDownsampler.process(upsampledSaw.data()) * downsamplerGain;
+        // the level lights and the history show the staircase in 16 steps at any resolution
+        float steps = first.steps[0] * (16.f / getLevels());
+        bitHistory.push(packBitState(bits, steps * (1.f / 16.f)));
 
         for (int l = 0; l < 8; ++l) {
             // each light covers 2 steps
@@ -239,21 +750,10 @@ struct Btfld : Module {
                 brightness += l * 2 <= steps ? 0.5f : 0.f;
                 brightness += l * 2 + 1 <= steps ? 0.5f : 0.f;
             }
-            lights[LEVEL_LIGHT + l].setBrightnessSmooth(brightness, args.sampleTime);
+            lights[LEVEL_LIGHT + l].setBrightnessSmooth(brightness, lightTime);
         }
 
-
-        saw *= 10.f;
-        auto rescaledSteps = steps * (10.f / 16.f);
-        auto filteredSteps = stepFilter.process(rescaledSteps);
-        outputs[STEP_OUT_OUTPUT].setVoltage(bipolar ? filteredSteps : rescaledSteps);
-        auto filteredSaw = sawFilter.process(saw);
-        feedback = std::min(std::max(-12.f, (bipolar ? filteredSaw : saw)), 12.f);
-
-        previousInputSignal = inputSignal;
-        previousSteps = steps;
-        setPosNegLight(SAW_INDICATOR_LIGHT, feedback, args.sampleTime);
-        outputs[SAW_OUTPUT].setVoltage(feedback);
+        setPosNegLight(SAW_INDICATOR_LIGHT, first.feedback[0], lightTime);
     }
 };
 
@@ -299,7 +799,49 @@ struct BtfldWidget : ModuleWidget {
         addChild(createLightCentered<MediumLight<RedGreenBlueLight>>(mm2px(Vec(13.868, 79.389)), module, Btfld::CV_INDICATOR_LIGHT));
         addChild(createLightCentered<MediumLight<RedGreenBlueLight>>(mm2px(Vec(13.868, 92.543)), module, Btfld::INJECT_INDICATOR_LIGHT));
         addChild(createLightCentered<MediumLight<BlueLight>>(mm2px(Vec(13.868, 105.232)), module, Btfld::STEP_INDICATOR_LIGHT));
+
+        addChild(createBitHistoryDisplay(mm2px(Vec(2.5, 116.6)), mm2px(Vec(25.48, 5.4)), module, NIBBLE));
 	}
+
+    void appendContextMenu(Menu* menu) override {
+        auto module = getModule<Btfld>();
+        if (!module) {
+            return;
+        }
+        menu->addChild(new MenuSeparator);
+        auto update = [=]() { module->updateEngines(); };
+        menu->addChild(createIndexSubmenuItem("Anti-aliasing", {"Oversampling", "ADAA", "ADAA, 2x oversampled"},
+            [=]() -> size_t {
+                return module->engineType;
+            },
+            [=](size_t index) {
+                module->engineType = index;
+                update();
+            }));
+        std::vector<std::string> resolutionLabels;
+        for (auto r : BTFLD_RESOLUTIONS) {
+            resolutionLabels.push_back(string::f("%d bits", r));
+        }
+        menu->addChild(createIndexSubmenuItem("Resolution", resolutionLabels,
+            [=]() -> size_t {
+                for (size_t i = 0; i < BTFLD_NUM_RESOLUTIONS; ++i) {
+                    if (BTFLD_RESOLUTIONS[i] == module->resolution) {
+                        return i;
+                    }
+                }
+                return 0;
+            },
+            [=](size_t index) {
+                module->resolution = BTFLD_RESOLUTIONS[index];
+                update();
+            }));
+        appendOversamplingMenu(menu, &module->oversampling, module->sampleRate, BTFLD_UPSAMPLE_RATIO, update);
+        appendBlockMenu(menu, &module->blockProcessing, module->sampleRate, update);
+        appendBitHistoryMenu(menu, &module->bitHistorySettings);
+#ifdef SCHLAPPI_PROFILE
+        appendProfileMenu(menu, &module->profile, "BTFLD");
+#endif
+    }
 };
 
 
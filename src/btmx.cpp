@@ -1,11 +1,403 @@
 #include "plugin.hpp"
 #include "widgets/schlappi_widgets.hpp"
+#include "dsp/resampler.hpp"
+#include "dsp/oversampling.hpp"
+#include "dsp/static_input.hpp"
+#include "dsp/edges.hpp"
+#include "dsp/block.hpp"
+#include "dsp/pipeline.hpp"
+#include "dsp/engines.hpp"
+#include "dsp/bus.hpp"
+#include "dsp/masks.hpp"
+#include "dsp/minblep.hpp"
+#include "dsp/telemetry.hpp"
+#include "dsp/profiling.hpp"
 #include <rack.hpp>
 #include <array>
 #include <cmath>
 
-#define UPSAMPLE_RATIO 16
-#define UPSAMPLE_QUALITY 4
+// defaults, the context menu can pick another ratio and quality
+#define BTMX_UPSAMPLE_RATIO 16
+#define BTMX_UPSAMPLE_QUALITY 4
+#define BTMX_UPSAMPLER_CUTOFF 0.2f
+#define BTMX_DECIMATOR_CUTOFF 0.8f
+// minBLEP table size of the band-limited step engine, the low-cost profile halves the length of every step
+#ifdef SCHLAPPI_LOW_COST
+#define BTMX_MINBLEP_ZERO_CROSSINGS 8
+#else
+#define BTMX_MINBLEP_ZERO_CROSSINGS 16
+#endif
+#define BTMX_MINBLEP_OVERSAMPLE 16
+
+// eight inputs in, four mix outputs out
+typedef FrameBlock<8, 4> BtmxBlock;
+
+#define BTMX_CHUNK_MASKS ((BLOCK_CHUNK_MAX_SUBSAMPLES + SUBSAMPLES_PER_MASK - 1) / SUBSAMPLES_PER_MASK)
+
+// Trigger states of the inputs and the logic outputs of one chunk in BtmxOversampledEngine, see dsp/masks.hpp. Shared
+// by all engines on a thread, the subsamples themselves are in the pipeline's buffers.
+struct BtmxChunkBuffers {
+    std::array<std::array<SubsampleMask, BTMX_CHUNK_MASKS>, 8> inputHigh;
+    std::array<std::array<SubsampleMask, BTMX_CHUNK_MASKS>, 4> mixHigh;
+};
+
+// Applies the logic to packed states, a[r] and b[r] are inputs r and r + 4, out[r] is mix output r. Every word
+// operation covers 16 subsamples of four channels, ADD is a ripple carry adder over the rows run on all of them at once.
+inline void btmxMaskLogic(const std::array<const SubsampleMask*, 4>& a, const std::array<const SubsampleMask*, 4>& b,
+                          int masks, int logicMode, const std::array<SubsampleMask*, 4>& out) {
+    for (auto w = 0; w < masks; ++w) {
+        if (logicMode == 0) {
+            for (auto row = 0; row < 4; ++row) {
+                out[row][w] = a[row][w] & b[row][w];
+            }
+        } else if (logicMode == 1) {
+            // the carry runs from row 4 up to row 1
+            SubsampleMask carry = 0;
+            for (int row = 3; row >= 0; --row) {
+                SubsampleMask x = a[row][w];
+                SubsampleMask y = b[row][w];
+                out[row][w] = x ^ y ^ carry;
+                carry = (x & y) | (carry & (x ^ y));
+            }
+        } else if (logicMode == 2) {
+            for (auto row = 0; row < 4; ++row) {
+                out[row][w] = a[row][w] | b[row][w];
+            }
+        } else {
+            for (auto row = 0; row < 4; ++row) {
+                out[row][w] = a[row][w] ^ b[row][w];
+            }
+        }
+    }
+}
+
+// Gate logic for one group of four polyphony channels. The oversampled part lives in BtmxOversampledEngine so that
+// the ratio and filter quality can be chosen at runtime while the inner loops stay specialized.
+struct BtmxEngine {
+    // decimated logic outputs of the last process() call
+    std::array<float_4, 4> mixOuts;
+    // Schmitt trigger states after the last subsample, for the lights
+    std::array<float_4, 8> inputHigh;
+
+    // the expander bus feeding inputs 1-4, input r takes stream 3 - r
+    BusInput bus;
+    // mix outputs of the last frame's subsamples for the expander bus, mix r is stream 3 - r
+    BusGroup busStates;
+    // set by the module when it builds the engine, oversampled engines then time input edges instead of upsampling
+    bool edgeTimedInputs = false;
+
+    BtmxEngine() {
+        for (auto& m : mixOuts) { m = 0.f; }
+        for (auto& h : inputHigh) { h = float_4::mask(); }
+    }
+
+    virtual ~BtmxEngine() {}
+
+    // size of the whole engine, for the per-instance memory budget
+    virtual size_t stateBytes() = 0;
+
+    // subsamples per frame in busStates, 0 for engines that do not fill them
+    virtual int busRatio() {
+        return 0;
+    }
+
+    virtual void process(const std::array<float_4, 8>& inputVoltages, int logicMode) = 0;
+
+    // Processes a full block in place. Engines without a block path run process() once per frame.
+    virtual void processBlock(BtmxBlock& block, int frames, int logicMode) {
+        std::array<float_4, 8> inputVoltages;
+        for (auto f = 0; f < frames; ++f) {
+            for (auto i = 0; i < 8; ++i) {
+                inputVoltages[i] = block.inputs[i][f];
+            }
+            process(inputVoltages, logicMode);
+            storeOutputs(block, f);
+        }
+    }
+
+    void storeOutputs(BtmxBlock& block, int f) const {
+        for (auto row = 0; row < 4; ++row) {
+            block.outputs[row][f] = mixOuts[row];
+        }
+    }
+};
+
+// Upsamples the eight inputs, runs the triggers and the logic over every subsample and decimates the mix outputs, see
+// OversampledPipeline. Per-sample processing is a chunk of one frame.
+template <int RATIO, int QUALITY>
+struct BtmxOversampledEngine : BtmxEngine {
+    typedef OversampledPipeline<RATIO, QUALITY, 8, 4> Pipeline;
+
+    std::array<dsp::TSchmittTrigger<float_4>, 8> triggers;
+
+    // the trigger thresholds are set against the gain of the unnormalized kernel
+    Pipeline pipeline{BTMX_UPSAMPLER_CUTOFF, false, BTMX_DECIMATOR_CUTOFF};
+    // last frame's input voltages, for edge-timed inputs
+    std::array<float_4, 8> previousInputs;
+    // high threshold of edge-timed inputs, 1V over the upsampler gain, where an upsampled input crosses 1V
+    const float edgeHighThreshold = 1.f / SharedResamplerKernel<RATIO, QUALITY>::gain(BTMX_UPSAMPLER_CUTOFF);
+
+    // logic mode of the frames being processed, a change restarts the static input check
+    int activeLogicMode = -1;
+
+    size_t stateBytes() override {
+        return sizeof(*this);
+    }
+
+    int busRatio() override {
+        return RATIO;
+    }
+
+    BtmxOversampledEngine() {
+        for (auto& trigger : triggers) {
+            trigger.reset();
+        }
+        for (auto& v : previousInputs) { v = 0.f; }
+    }
+
+    void setLogicMode(int logicMode) {
+        if (logicMode != activeLogicMode) {
+            activeLogicMode = logicMode;
+            pipeline.staticInputs.reset();
+        }
+    }
+
+    typename Pipeline::Outputs heldOutputs() {
+        return {{&mixOuts[0], &mixOuts[1], &mixOuts[2], &mixOuts[3]}};
+    }
+
+    void process(const std::array<float_4, 8>& inputVoltages, int logicMode) override {
+        setLogicMode(logicMode);
+        pipeline.process(inputVoltages, *this, heldOutputs());
+    }
+
+    void processBlock(BtmxBlock& block, int frames, int logicMode) override {
+        setLogicMode(logicMode);
+        pipeline.processBlock(block, frames, *this, heldOutputs());
+    }
+
+    bool upsampleInputs() const {
+        return !edgeTimedInputs;
+    }
+
+    // a bus-fed input can change within a frame while its voltage does not
+    void staticCheck(typename Pipeline::Frame& check) const {
+        for (int i = 0; i < 4; ++i) {
+            if (bus.uses(i)) {
+                check[i] = busCheckValue(bus.group->states[3 - i]);
+            }
+        }
+    }
+
+    int chunkFrames() const {
+        return BLOCK_CHUNK_FRAMES;
+    }
+
+    // Triggers the inputs into packed states, applies the logic to them and unpacks the mix outputs for the decimators
+    void processSubsamples(const typename Pipeline::Inputs& in, int frames, const std::array<float_4*, 8>& upsampled,
+                           const typename Pipeline::Outputs& out) {
+        auto& buffers = chunkBuffers<BtmxChunkBuffers>();
+        auto& inputMasks = buffers.inputHigh;
+        auto& mixMasks = buffers.mixHigh;
+
+        const int subsamples = frames * RATIO;
+        const int masks = subsampleMasks(subsamples);
+        // the bus is only set for single frames
+        for (int i = 0; i < 4; ++i) {
+            if (bus.uses(i)) {
+                unpackBusStates<RATIO>(bus.group->states[3 - i], bus.ratio, upsampled[i]);
+            }
+        }
+        for (int i = 0; i < 8; ++i) {
+            if (edgeTimedInputs && !(i < 4 && bus.uses(i))) {
+                std::fill(inputMasks[i].begin(), inputMasks[i].begin() + masks, 0);
+                for (int f = 0; f < frames; ++f) {
+                    // a frame never straddles two masks, RATIO divides SUBSAMPLES_PER_MASK
+                    const int first = f * RATIO;
+                    inputMasks[i][first / SUBSAMPLES_PER_MASK] |=
+                            edgeTimedStates<RATIO>(triggers[i], previousInputs[i], in[i][f], 0.f, edgeHighThreshold)
+                            << (4 * (first % SUBSAMPLES_PER_MASK));
+                }
+                inputHigh[i] = triggers[i].isHigh();
+                continue;
+            }
+            for (int w = 0; w < masks; ++w) {
+                SubsampleMask mask = 0;
+                const int first = w * SUBSAMPLES_PER_MASK;
+                const int n = std::min(SUBSAMPLES_PER_MASK, subsamples - first);
+                for (int s = 0; s < n; ++s) {
+                    triggers[i].process(upsampled[i][first + s]);
+                    mask |= static_cast<SubsampleMask>(simd::movemask(triggers[i].isHigh())) << (4 * s);
+                }
+                inputMasks[i][w] = mask;
+            }
+            inputHigh[i] = triggers[i].isHigh();
+            previousInputs[i] = in[i][frames - 1];
+        }
+
+        btmxMaskLogic({{inputMasks[0].data(), inputMasks[1].data(), inputMasks[2].data(), inputMasks[3].data()}},
+                      {{inputMasks[4].data(), inputMasks[5].data(), inputMasks[6].data(), inputMasks[7].data()}},
+                      masks, activeLogicMode,
+                      {{mixMasks[0].data(), mixMasks[1].data(), mixMasks[2].data(), mixMasks[3].data()}});
+        for (auto row = 0; row < 4; ++row) {
+            unpackMasks(mixMasks[row].data(), subsamples, out[row]);
+        }
+        for (auto row = 0; row < 4; ++row) {
+            packBusStates<RATIO>(&out[row][(frames - 1) * RATIO], busStates.states[3 - row]);
+        }
+    }
+};
+
+// Bit r of a and b is the trigger state of input r and r + 4, bit r of the result is mix output r
+inline int btmxLogic(int a, int b, int logicMode) {
+    if (logicMode == 0) {
+        return a & b;
+    } else if (logicMode == 2) {
+        return a | b;
+    } else if (logicMode == 3) {
+        return a ^ b;
+    }
+    // ADD, the carry runs from row 4 up to row 1
+    int out = 0;
+    int carry = 0;
+    for (int row = 3; row >= 0; --row) {
+        int x = (a >> row) & 1;
+        int y = (b >> row) & 1;
+        out |= (x ^ y ^ carry) << row;
+        carry = (x & y) | (carry & (x ^ y));
+    }
+    return out;
+}
+
+// Runs the logic at the engine rate and renders the mix outputs as band-limited steps. Every input edge is timed from
+// the linearly interpolated input, the logic is evaluated once per edge in time order, and each change of a mix output
+// inserts a minBLEP at that position. Samples without edges only cost the Schmitt triggers and reading the minBLEP
+// buffers.
+struct BtmxMinBlepEngine : BtmxEngine {
+    std::array<dsp::TSchmittTrigger<float_4>, 8> triggers;
+    std::array<float_4, 8> previousVoltages;
+    std::array<SharedMinBlepGenerator<BTMX_MINBLEP_ZERO_CROSSINGS, BTMX_MINBLEP_OVERSAMPLE, float_4>, 4> minBleps;
+
+    // naive mix output bits per channel, bit r is row r
+    std::array<int, 4> rows;
+    int previousLogicMode = -1;
+
+    size_t stateBytes() override {
+        return sizeof(*this);
+    }
+
+    BtmxMinBlepEngine() {
+        for (auto& trigger : triggers) {
+            trigger.reset();
+        }
+        for (auto& v : previousVoltages) { v = 0.f; }
+    }
+
+    void process(const std::array<float_4, 8>& inputVoltages, int logicMode) override {
+        PROFILE_START();
+        std::array<int, 8> highBefore;
+        int changed = 0;
+        for (int i = 0; i < 8; ++i) {
+            highBefore[i] = simd::movemask(triggers[i].isHigh());
+            triggers[i].process(inputVoltages[i]);
+            inputHigh[i] = triggers[i].isHigh();
+            changed |= highBefore[i] ^ simd::movemask(inputHigh[i]);
+        }
+
+        if (previousLogicMode < 0) {
+            // first call, start from the current states without a step
+            previousLogicMode = logicMode;
+            for (int c = 0; c < 4; ++c) {
+                rows[c] = btmxLogic(laneBits(highBefore, c, 0), laneBits(highBefore, c, 4), logicMode);
+            }
+        }
+
+        if (changed || logicMode != previousLogicMode) {
+            for (int c = 0; c < 4; ++c) {
+                processEdges(inputVoltages, highBefore, c, logicMode);
+            }
+            previousLogicMode = logicMode;
+        }
+        PROFILE_LAP(PROFILE_CORE);
+
+        for (int row = 0; row < 4; ++row) {
+            float_4 naive;
+            for (int c = 0; c < 4; ++c) {
+                naive[c] = (rows[c] >> row) & 1;
+            }
+            mixOuts[row] = naive + minBleps[row].process();
+        }
+        PROFILE_LAP(PROFILE_OUTPUT);
+        previousVoltages = inputVoltages;
+    }
+
+    static int laneBits(const std::array<int, 8>& high, int c, int first) {
+        int bits = 0;
+        for (int r = 0; r < 4; ++r) {
+            bits |= ((high[first + r] >> c) & 1) << r;
+        }
+        return bits;
+    }
+
+    // Replays this sample's input edges of channel c in time order and steps the mix outputs that change
+    void processEdges(const std::array<float_4, 8>& inputVoltages, const std::array<int, 8>& highBefore, int c,
+                      int logicMode) {
+        std::array<float, 8> phases;
+        std::array<int, 8> order;
+        int edges = 0;
+        int states = 0;
+        for (int i = 0; i < 8; ++i) {
+            bool before = (highBefore[i] >> c) & 1;
+            bool after = (simd::movemask(inputHigh[i]) >> c) & 1;
+            states |= before << i;
+            if (before != after) {
+                phases[i] = schmittCrossingPhase(previousVoltages[i][c], inputVoltages[i][c], after);
+                // insertion sort, there are at most eight edges
+                int k = edges++;
+                while (k > 0 && phases[order[k - 1]] > phases[i]) {
+                    order[k] = order[k - 1];
+                    --k;
+                }
+                order[k] = i;
+            }
+        }
+
+        // edges use the logic mode they happened under, a mode change takes effect at the end of the sample
+        for (int e = 0; e < edges; ++e) {
+            states ^= 1 << order[e];
+            step(c, btmxLogic(states & 15, states >> 4, previousLogicMode), phases[order[e]]);
+        }
+        step(c, btmxLogic(states & 15, states >> 4, logicMode), 0.f);
+    }
+
+    void step(int c, int newRows, float phase) {
+        int flipped = rows[c] ^ newRows;
+        for (int row = 0; row < 4; ++row) {
+            if ((flipped >> row) & 1) {
+                float_4 jump = 0.f;
+                jump[c] = ((newRows >> row) & 1) ? 1.f : -1.f;
+                minBleps[row].insertDiscontinuity(phase, jump);
+            }
+        }
+        rows[c] = newRows;
+    }
+};
+
+// The settings BTMX engines are built for, changing any of them takes new engines
+struct BtmxEngineConfig {
+    int engineType = 0;
+    int ratio = 0;
+    int quality = 0;
+    bool edgeTimed = false;
+    int blockSize = 0;
+
+    bool operator==(const BtmxEngineConfig& other) const {
+        return engineType == other.engineType && ratio == other.ratio && quality == other.quality &&
+               edgeTimed == other.edgeTimed && blockSize == other.blockSize;
+    }
+};
+
+typedef EngineSet<BtmxEngine, BtmxBlock, BtmxEngineConfig> BtmxEngineSet;
 
 struct BTMX : Module {
 	enum ParamId {
@@ -37,16 +429,41 @@ struct BTMX : Module {
         XOR
     };
 
-    std::array<dsp::SchmittTrigger, 8> triggers;
-    std::array<float, 4> mixOuts;
+    enum EngineType {
+        OVERSAMPLED_ENGINE,
+        MINBLEP_ENGINE
+    };
+
+    std::array<float_4, 8> inputVoltages;
 
-    std::array<dsp::Decimator<UPSAMPLE_RATIO, UPSAMPLE_QUALITY>, 4> decimators;
-    std::array<dsp::Upsampler<UPSAMPLE_RATIO, UPSAMPLE_QUALITY>, 8> upsamplers;
-    std::array<std::array<bool, UPSAMPLE_RATIO>, 8> upsampledTriggers;
-    std::array<std::array<float, UPSAMPLE_RATIO>, 4> upsampledMixOuts;
-    std::array<float, UPSAMPLE_RATIO> workingBuffer;
+    OversamplingSettings oversampling{BTMX_UPSAMPLE_QUALITY};
+    GateInputSettings gateInputs;
+    BlockSettings blockProcessing;
+    BitHistorySettings bitHistorySettings;
 
-    float gateVoltage;
+    // lights and the bit history run at control rate
+    dsp::ClockDivider lightDivider;
+    BitHistory bitHistory;
+
+    // the mix streams for a BTMX or Nibbler on the right
+    std::array<BusMessage, 2> busMessages;
+    // normals unpatched inputs 1-4 to the bits of a BTFLD or BTMX on the left, off unless set in the menu
+    bool busInputs = false;
+
+#ifdef SCHLAPPI_PROFILE
+    ModuleProfile profile;
+#endif
+#ifdef SCHLAPPI_LOW_COST
+    // runs at the engine rate with integer row logic and only pays for the minBLEP on edges
+    static const int DEFAULT_ENGINE = MINBLEP_ENGINE;
+#else
+    static const int DEFAULT_ENGINE = OVERSAMPLED_ENGINE;
+#endif
+    int engineType = DEFAULT_ENGINE;
+    float sampleRate = OVERSAMPLING_REFERENCE_RATE;
+
+    // one engine per group of four polyphony channels and the frame blocks of block mode
+    EngineHandoff<BtmxEngineSet> engineSets;
 
     BTMX() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -74,90 +491,188 @@ struct BTMX : Module {
         configOutput(MIX_OUTPUT + 2, "Mix 3 ★ 7");
 		configOutput(MIX_OUTPUT + 3, "Mix 4 ★ 8");
 
-        for (auto& trigger : triggers) {
-            trigger.reset();
-        }
+        initBusProducer(this, busMessages);
+        lightDivider.setDivision(TELEMETRY_DIVISION);
+        updateEngines();
+    }
+
+    // Builds new engines when the engine type, the gate inputs, block processing or the ratio and quality the
+    // oversampling settings ask for at this sample rate change. Called where those change, never from process(),
+    // which switches to the new engines through engineSets.
+    void updateEngines() {
+        BtmxEngineConfig config;
+        config.engineType = engineType;
+        config.ratio = oversampling.resolveRatio(sampleRate, BTMX_UPSAMPLE_RATIO);
+        config.quality = oversampling.quality;
+        config.edgeTimed = gateInputs.edgeTimed;
+        config.blockSize = blockProcessing.size;
+        engineSets.update(config, [](const BtmxEngineConfig& config) {
+            auto set = new BtmxEngineSet(config);
+            for (auto& engine : set->engines) {
+                if (config.engineType == MINBLEP_ENGINE) {
+                    engine.reset(new BtmxMinBlepEngine);
+                } else {
+                    engine.reset(createOversampledEngine<BtmxEngine, BtmxOversampledEngine>(config.ratio,
+                                                                                            config.quality));
+                }
+                engine->edgeTimedInputs = config.edgeTimed;
+            }
+            return set;
+        });
+    }
 
-        std::fill(upsamplers.begin(), upsamplers.end(), 0.2f);
-        std::fill(decimators.begin(), decimators.end(), 0.8f);
+    // Memory held by this instance: the module, its engines and the frame blocks of block mode. The chunk buffers are
+    // shared per thread and not counted.
+    size_t stateBytes() {
+        return sizeof(*this) + engineSets.current->stateBytes();
+    }
+
+    void onSampleRateChange(const SampleRateChangeEvent& e) override {
+        sampleRate = e.sampleRate;
+        updateEngines();
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        oversampling.toJson(rootJ);
+        gateInputs.toJson(rootJ);
+        blockProcessing.toJson(rootJ);
+        bitHistorySettings.toJson(rootJ);
+        json_object_set_new(rootJ, "engine", json_integer(engineType));
+        json_object_set_new(rootJ, "busInputs", json_boolean(busInputs));
+        return rootJ;
+    }
 
-        float kernelSum = 0;
-        for (auto i = 0; i < UPSAMPLE_RATIO * UPSAMPLE_QUALITY; ++i) {
-            kernelSum += decimators[0].kernel[i];
+    void dataFromJson(json_t* rootJ) override {
+        oversampling.fromJson(rootJ);
+        gateInputs.fromJson(rootJ);
+        blockProcessing.fromJson(rootJ);
+        bitHistorySettings.fromJson(rootJ);
+        json_t* engineJ = json_object_get(rootJ, "engine");
+        if (engineJ) {
+            engineType = json_integer_value(engineJ) == MINBLEP_ENGINE ? MINBLEP_ENGINE : OVERSAMPLED_ENGINE;
         }
-        gateVoltage = 10.f / kernelSum;
+        json_t* busInputsJ = json_object_get(rootJ, "busInputs");
+        if (busInputsJ) {
+            busInputs = json_boolean_value(busInputsJ);
+        }
+        updateEngines();
     }
 
 	void process(const ProcessArgs& args) override {
+        PROFILE_FRAME(profile);
+        auto& engineSet = engineSets.acquire();
+        auto& engines = engineSet.engines;
+        int blockSize = engineSet.config.blockSize;
+
+        // with busInputs set, inputs 1-4 are normalled to the bit streams of a BTFLD or BTMX on the left. The bus only
+        // counts, and only widens the polyphony, while one of them is switched on and unpatched.
+        bool busNormalled = false;
+        for (int i = 0; i < 4; ++i) {
+            busNormalled |= params[SWITCH_PARAM + i].getValue() > 0.5 && !inputs[IN_INPUT + i].isConnected();
+        }
+        const BusMessage* busIn = busInputs && busNormalled ? readBus(this) : nullptr;
+        BusMessage* busOut = busProducerMessage(this);
+
+        int channels = std::max(1, busIn ? busIn->channels : 0);
         for (int i = 0; i < 8; ++i) {
-            auto inputVoltage = params[SWITCH_PARAM + i].getValue() > 0.5 ?
-                    (inputs[IN_INPUT + i].isConnected() ? inputs[IN_INPUT + i].getVoltage() : 10.f) :
-                    0;
-            upsamplers[i].process(inputVoltage, &workingBuffer[0]);
-            for (int samp = 0; samp < UPSAMPLE_RATIO; ++samp) {
-                triggers[i].process(workingBuffer[samp]);
-                upsampledTriggers[i][samp] = triggers[i].isHigh();
-            }
-            lights[IN_INDICATOR_LIGHT + i].setBrightnessSmooth(triggers[i].isHigh() ? 1.f : 0.f, args.sampleTime);
+            channels = std::max(channels, inputs[IN_INPUT + i].getChannels());
         }
 
         int logicMode =
                 (params[LOGIC_MODE_A].getValue() > 0.5 ? 2 : 0) +
                 (params[LOGIC_MODE_B].getValue() > 0.5 ? 1 : 0);
 
-        if (logicMode == 0) {
-            // AND
-            for (auto row = 0; row < 4; ++row) {
-                for (auto subsample = 0; subsample < UPSAMPLE_RATIO; ++subsample) {
-                    upsampledMixOuts[row][subsample] =
-                            (upsampledTriggers[row][subsample] && upsampledTriggers[row+4][subsample]) ? 1.f : 0.f;
+        for (int c = 0; c < channels; c += 4) {
+            auto& engine = *engines[c / 4];
+
+            const BusGroup* busGroup = busIn && c < busIn->channels ? &busIn->groups[c / 4] : nullptr;
+            engine.bus = BusInput();
+            for (int i = 0; i < 8; ++i) {
+                inputVoltages[i] = params[SWITCH_PARAM + i].getValue() > 0.5 ?
+                        (inputs[IN_INPUT + i].isConnected() ? inputs[IN_INPUT + i].getPolyVoltageSimd<float_4>(c) : 10.f) :
+                        0.f;
+                if (busGroup && i < 4 && params[SWITCH_PARAM + i].getValue() > 0.5 && !inputs[IN_INPUT + i].isConnected()) {
+                    inputVoltages[i] = busFrameVoltage(busGroup->states[3 - i], busIn->ratio);
+                    engine.bus.inputs |= 1 << i;
                 }
             }
-        } else if (logicMode == 1) {
-            // ADD
-            for (auto subsample = 0; subsample < UPSAMPLE_RATIO; ++subsample) {
-                int carry = 0;
-                for (int row = 3; row >= 0; --row) {
-                    carry += upsampledTriggers[row][subsample] ? 1 : 0;
-                    carry += upsampledTriggers[row+4][subsample] ? 1 : 0;
-                    upsampledMixOuts[row][subsample] = (carry & 1) ? 1.f : 0.f;
-                    carry >>= 1;
-                }
+            if (busGroup && blockSize == 0) {
+                engine.bus.group = busGroup;
+                engine.bus.ratio = busIn->ratio;
             }
-        } else if (logicMode == 2) {
-            // OR
-            for (auto row = 0; row < 4; ++row) {
-                for (auto subsample = 0; subsample < UPSAMPLE_RATIO; ++subsample) {
-                    upsampledMixOuts[row][subsample] =
-                            (upsampledTriggers[row][subsample] || upsampledTriggers[row + 4][subsample]) ? 1.f : 0.f;
+
+            // in block mode the outputs lag by blockSize frames
+            std::array<float_4, 4> mixOuts;
+            if (blockSize > 0) {
+                auto& frameBlock = (*engineSet.frameBlocks)[c / 4];
+                if (frameBlock.push(inputVoltages, mixOuts, blockSize)) {
+                    engine.processBlock(frameBlock, blockSize, logicMode);
                 }
+            } else {
+                engine.process(inputVoltages, logicMode);
+                mixOuts = engine.mixOuts;
             }
-        } else if (logicMode == 3) {
-            // XOR
-            for (auto row = 0; row < 4; ++row) {
-                for (auto subsample = 0; subsample < UPSAMPLE_RATIO; ++subsample) {
-                    upsampledMixOuts[row][subsample] =
-                            (upsampledTriggers[row][subsample] != upsampledTriggers[row + 4][subsample]) ? 1.f : 0.f;
+
+            if (busOut) {
+                if (blockSize > 0 || engine.busRatio() == 0) {
+                    // delayed block outputs or minBLEP steps, sent one state per frame
+                    for (auto row = 0; row < 4; ++row) {
+                        packBusStates<1>(&mixOuts[row], busOut->groups[c / 4].states[3 - row]);
+                    }
+                } else {
+                    busOut->groups[c / 4] = engine.busStates;
                 }
             }
+
+            auto stepOut =
+                    mixOuts[0] * 8.f +
+                    mixOuts[1] * 4.f +
+                    mixOuts[2] * 2.f +
+                    mixOuts[3] * 1.f;
+
+            for (auto i = 0; i < 4; ++i) {
+                outputs[MIX_OUTPUT + i].setVoltageSimd(mixOuts[i] * 10.f, c);
+            }
+            outputs[STEP_OUTPUT].setVoltageSimd(stepOut * (10.f / 15.f), c);
         }
-        for (auto row = 0; row < 4; ++row) {
-            mixOuts[row] = decimators[row].process(&upsampledMixOuts[row][0]);
+
+        for (auto o = 0; o < OUTPUTS_LEN; ++o) {
+            outputs[o].setChannels(channels);
         }
 
-        auto stepOut =
-                mixOuts[0] * 8 +
-                mixOuts[1] * 4 +
-                mixOuts[2] * 2 +
-                mixOuts[3] * 1;
+        if (busOut) {
+            busOut->ratio = blockSize > 0 ? 1 : std::max(engines[0]->busRatio(), 1);
+            busOut->channels = channels;
+            rightExpander.requestMessageFlip();
+        }
 
-        for (auto i = 0; i < 4; ++i) {
-            outputs[MIX_OUTPUT + i].setVoltage(mixOuts[i] * gateVoltage);
-            lights[MIX_INDICATOR_LIGHT + i].setBrightnessSmooth(mixOuts[i], args.sampleTime);
+        if (lightDivider.process()) {
+            PROFILE_START();
+            updateLights(args.sampleTime * lightDivider.getDivision());
+            PROFILE_LAP(PROFILE_LIGHTS);
         }
+    }
 
-        outputs[STEP_OUTPUT].setVoltage(stepOut * (10.f / 15.f));
-        lights[STEP_INDICATOR_LIGHT].setBrightnessSmooth(stepOut * (1.f / 15.f), args.sampleTime);
+    // lights and the bit history follow the first channel
+    void updateLights(float lightTime) {
+        auto& first = *engineSets.current->engines[0];
+        for (int i = 0; i < 8; ++i) {
+            lights[IN_INDICATOR_LIGHT + i].setBrightnessSmooth((simd::movemask(first.inputHigh[i]) & 1) ? 1.f : 0.f, lightTime);
+        }
+        int bits = 0;
+        for (auto i = 0; i < 4; ++i) {
+            lights[MIX_INDICATOR_LIGHT + i].setBrightnessSmooth(first.mixOuts[i][0], lightTime);
+            // mix 1 is the most significant bit of the step output
+            bits |= first.mixOuts[i][0] > 0.5f ? 8 >> i : 0;
+        }
+        auto stepOut =
+                first.mixOuts[0][0] * 8 +
+                first.mixOuts[1][0] * 4 +
+                first.mixOuts[2][0] * 2 +
+                first.mixOuts[3][0] * 1;
+        lights[STEP_INDICATOR_LIGHT].setBrightnessSmooth(stepOut * (1.f / 15.f), lightTime);
+        bitHistory.push(packBitState(bits, stepOut * (1.f / 15.f)));
     }
 };
 
@@ -215,8 +730,35 @@ struct BTMXWidget : ModuleWidget {
         addChild(createLightCentered<MediumLight<BlueLight>>(mm2px(Vec(38.026, 79.302)), module, BTMX::MIX_INDICATOR_LIGHT + 1));
         addChild(createLightCentered<MediumLight<BlueLight>>(mm2px(Vec(38.026, 92.624)), module, BTMX::MIX_INDICATOR_LIGHT + 2));
         addChild(createLightCentered<MediumLight<BlueLight>>(mm2px(Vec(38.026, 105.271)), module, BTMX::MIX_INDICATOR_LIGHT + 3));
+
+        addChild(createBitHistoryDisplay(mm2px(Vec(2.5, 116.6)), mm2px(Vec(35.64, 5.4)), module, 4));
 	}
 
+    void appendContextMenu(Menu* menu) override {
+        auto module = getModule<BTMX>();
+        if (!module) {
+            return;
+        }
+        menu->addChild(new MenuSeparator);
+        auto update = [=]() { module->updateEngines(); };
+        menu->addChild(createIndexSubmenuItem("Output engine", {"Oversampled", "Band-limited steps (minBLEP)"},
+            [=]() -> size_t {
+                return module->engineType;
+            },
+            [=](size_t index) {
+                module->engineType = index;
+                update();
+            }));
+        appendOversamplingMenu(menu, &module->oversampling, module->sampleRate, BTMX_UPSAMPLE_RATIO, update);
+        appendGateInputMenu(menu, &module->gateInputs, update);
+        appendBlockMenu(menu, &module->blockProcessing, module->sampleRate, update);
+        appendBitHistoryMenu(menu, &module->bitHistorySettings);
+        menu->addChild(createBoolPtrMenuItem("Normal inputs 1-4 to the module on the left", "", &module->busInputs));
+#ifdef SCHLAPPI_PROFILE
+        appendProfileMenu(menu, &module->profile, "BTMX");
+#endif
+    }
+
 };
 
 
@@ -0,0 +1,100 @@
+#ifndef SCHLAPPI_VCV_BLOCK_H
+#define SCHLAPPI_VCV_BLOCK_H
+
+#include <rack.hpp>
+#include "oversampling.hpp"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace rack;
+using simd::float_4;
+
+// Block sizes in frames the block processing mode offers
+static const int BLOCK_SIZES[] = {8, 16, 32, 64};
+#define BLOCK_NUM_SIZES (sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0]))
+#define BLOCK_MAX_FRAMES 64
+// Engines run each stage over this many frames at a time, which bounds their scratch buffers
+#define BLOCK_CHUNK_FRAMES 8
+#define BLOCK_CHUNK_MAX_SUBSAMPLES (OVERSAMPLING_MAX_RATIO * BLOCK_CHUNK_FRAMES)
+
+// The buffers an engine works through a chunk in hold nothing from one call to the next, so instead of every engine
+// carrying its own set, each thread that runs engines has one T, sized for the highest oversampling ratio.
+template <typename T>
+T& chunkBuffers() {
+    static thread_local T buffers;
+    return buffers;
+}
+
+// Opt-in block processing from the context menu. The module buffers `size` frames and hands them to its engines in
+// one go, so the outputs lag the inputs by exactly `size` frames. Like the oversampling settings, the menu writes the
+// field and the module allocates the frame blocks with its next engines.
+struct BlockSettings {
+    // 0 processes every frame as it arrives
+    int size = 0;
+
+    void toJson(json_t* root) const {
+        json_object_set_new(root, "blockSize", json_integer(size));
+    }
+
+    void fromJson(json_t* root) {
+        json_t* sizeJ = json_object_get(root, "blockSize");
+        if (sizeJ) {
+            int s = json_integer_value(sizeJ);
+            size = std::find(std::begin(BLOCK_SIZES), std::end(BLOCK_SIZES), s) != std::end(BLOCK_SIZES) ? s : 0;
+        }
+    }
+};
+
+// Input and output frames of one group of four polyphony channels, one array per port
+template <int NUM_INPUTS, int NUM_OUTPUTS>
+struct FrameBlock {
+    std::array<std::array<float_4, BLOCK_MAX_FRAMES>, NUM_INPUTS> inputs;
+    std::array<std::array<float_4, BLOCK_MAX_FRAMES>, NUM_OUTPUTS> outputs;
+    int position = 0;
+
+    FrameBlock() {
+        for (auto& i : inputs) { i.fill(0.f); }
+        for (auto& o : outputs) { o.fill(0.f); }
+    }
+
+    /** Stores one frame of inputs and returns the outputs computed from the inputs `size` frames ago. Returns true
+     * once the block is full and has to be processed before the next push. */
+    bool push(const std::array<float_4, NUM_INPUTS>& in, std::array<float_4, NUM_OUTPUTS>& out, int size) {
+        for (auto i = 0; i < NUM_INPUTS; ++i) {
+            inputs[i][position] = in[i];
+        }
+        for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+            out[o] = outputs[o][position];
+        }
+        if (++position < size) {
+            return false;
+        }
+        position = 0;
+        return true;
+    }
+};
+
+inline void appendBlockMenu(Menu* menu, BlockSettings* settings, float sampleRate, std::function<void()> changed) {
+    std::vector<std::string> labels = {"Off"};
+    for (auto s : BLOCK_SIZES) {
+        labels.push_back(string::f("%d frames (%.2f ms latency)", s, 1000.f * s / sampleRate));
+    }
+    menu->addChild(createIndexSubmenuItem("Block processing", labels,
+        [=]() -> size_t {
+            for (size_t i = 0; i < BLOCK_NUM_SIZES; ++i) {
+                if (BLOCK_SIZES[i] == settings->size) {
+                    return i + 1;
+                }
+            }
+            return 0;
+        },
+        [=](size_t index) {
+            settings->size = index == 0 ? 0 : BLOCK_SIZES[index - 1];
+            changed();
+        }));
+}
+
+#endif //SCHLAPPI_VCV_BLOCK_H
@@ -0,0 +1,124 @@
+#ifndef SCHLAPPI_VCV_BUS_H
+#define SCHLAPPI_VCV_BUS_H
+
+#include "plugin.hpp"
+#include <array>
+#include <cstdint>
+
+using simd::float_4;
+
+// Expander bus between adjacent Schlappi modules. BTFLD (bit outputs) and BTMX (mix outputs) write the oversampled
+// states of their four bit streams to the module on their right every frame. A BTMX or Nibbler there with its bus
+// inputs turned on in the context menu normals its unpatched inputs to those streams:
+//   BTMX inputs 1-4 (switched on) take bits 8, 4, 2, 1, the same weights as its own mix outputs 1-4
+//   Nibbler gates 1, 2, 4, 8 take bits 1, 2, 4, 8
+// Oversampled consumer engines write the states straight into their upsampled inputs, so the bits skip the decimator,
+// the cable and the next upsampler. Everything else, and either side in block mode, falls back to one state per frame.
+// Like any expander message the bus arrives one frame late, the same as a cable. A consumer only takes on the
+// producer's polyphony while at least one of its inputs is normalled to a stream.
+#define BUS_STREAMS 4
+
+// Bit ss of states[b][c] is subsample ss of stream b (weight 2^b) on channel c of one polyphony group
+struct BusGroup {
+    std::array<std::array<uint16_t, 4>, BUS_STREAMS> states;
+
+    BusGroup() {
+        for (auto& stream : states) {
+            stream.fill(0);
+        }
+    }
+};
+
+struct BusMessage {
+    // subsamples per frame in the states, at most 16 so that a frame fits the uint16_t; 0 until the producer has run
+    int ratio = 0;
+    int channels = 0;
+    std::array<BusGroup, PORT_MAX_CHANNELS / 4> groups;
+};
+
+// The bus an oversampled consumer engine reads for one group. Its module sets it before every process() call and
+// leaves it empty in block mode, where the engine only sees the per-frame voltages.
+struct BusInput {
+    const BusGroup* group = nullptr;
+    int ratio = 0;
+    // bit i set for every engine input that takes a stream
+    int inputs = 0;
+
+    bool uses(int input) const {
+        return group && (inputs & (1 << input));
+    }
+};
+
+inline bool isBusProducer(Model* model) {
+    return model == modelBtfld || model == modelBTMX;
+}
+
+inline bool isBusConsumer(Model* model) {
+    return model == modelBTMX || model == modelNibbler;
+}
+
+// Gives the module a message buffer pair for the module on its right
+inline void initBusProducer(Module* module, std::array<BusMessage, 2>& messages) {
+    module->rightExpander.producerMessage = &messages[0];
+    module->rightExpander.consumerMessage = &messages[1];
+}
+
+inline bool hasBusConsumer(Module* module) {
+    return module->rightExpander.module && isBusConsumer(module->rightExpander.module->model);
+}
+
+// The message a producer fills this frame, or null when nothing on its right reads the bus. After filling it the
+// producer calls rightExpander.requestMessageFlip().
+inline BusMessage* busProducerMessage(Module* module) {
+    return hasBusConsumer(module) ? static_cast<BusMessage*>(module->rightExpander.producerMessage) : nullptr;
+}
+
+// The message of the producer on the left, or null when there is none or it has nothing to send
+inline const BusMessage* readBus(Module* module) {
+    Module* left = module->leftExpander.module;
+    if (!left || !isBusProducer(left->model)) {
+        return nullptr;
+    }
+    auto message = static_cast<const BusMessage*>(left->rightExpander.consumerMessage);
+    return message && message->ratio > 0 ? message : nullptr;
+}
+
+// Packs one frame of a 0..1 stream, RATIO subsamples
+template <int RATIO>
+void packBusStates(const float_4* stream, std::array<uint16_t, 4>& states) {
+    static_assert(RATIO <= 16, "a frame of bus states has to fit in 16 bits");
+    states.fill(0);
+    for (auto ss = 0; ss < RATIO; ++ss) {
+        int high = simd::movemask(stream[ss] > 0.5f);
+        for (auto c = 0; c < 4; ++c) {
+            states[c] |= ((high >> c) & 1) << ss;
+        }
+    }
+}
+
+// Unpacks a frame of states sent at busRatio into RATIO subsamples of 10V gates, holding the nearest earlier state
+template <int RATIO>
+void unpackBusStates(const std::array<uint16_t, 4>& states, int busRatio, float_4* out) {
+    for (auto ss = 0; ss < RATIO; ++ss) {
+        int source = ss * busRatio / RATIO;
+        for (auto c = 0; c < 4; ++c) {
+            out[ss][c] = ((states[c] >> source) & 1) ? 10.f : 0.f;
+        }
+    }
+}
+
+// The voltage standing in for a bus-fed input at the engine rate: the state of the last subsample
+inline float_4 busFrameVoltage(const std::array<uint16_t, 4>& states, int busRatio) {
+    float_4 v;
+    for (auto c = 0; c < 4; ++c) {
+        v[c] = ((states[c] >> (busRatio - 1)) & 1) ? 10.f : 0.f;
+    }
+    return v;
+}
+
+// What the static input check sees for a bus-fed input: it changes whenever a frame's states do
+inline float_4 busCheckValue(const std::array<uint16_t, 4>& states) {
+    return float_4(states[0], states[1], states[2], states[3]);
+}
+
+#endif //SCHLAPPI_VCV_BUS_H
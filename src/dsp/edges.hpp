@@ -0,0 +1,107 @@
+#ifndef SCHLAPPI_VCV_EDGES_H
+#define SCHLAPPI_VCV_EDGES_H
+
+#include <rack.hpp>
+#include "masks.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using namespace rack;
+using simd::float_4;
+
+// Where between the previous and the current sample a linearly interpolated input crosses the threshold, in the
+// (-1, 0] range that dsp::MinBlepGenerator::insertDiscontinuity() expects. -1 is the previous sample, 0 the current one.
+inline float crossingPhase(float previous, float current, float threshold) {
+    float delta = current - previous;
+    float fraction = delta != 0.f ? (threshold - previous) / delta : 1.f;
+    return std::min(std::max(fraction, 1e-6f), 1.f) - 1.f;
+}
+
+// Same for a dsp::TSchmittTrigger that just changed state: rising edges happen at the high threshold, falling edges at
+// the low one.
+inline float schmittCrossingPhase(float previous, float current, bool rising,
+                                  float lowThreshold = 0.f, float highThreshold = 1.f) {
+    return crossingPhase(previous, current, rising ? highThreshold : lowThreshold);
+}
+
+// Gate input front end of the oversampled engines: a dsp::TSchmittTrigger on the linearly interpolated input, timed to
+// the subsample without upsampling. Between two engine-rate samples the interpolated input is monotonic, so each
+// channel changes state at most once per frame, to the state the trigger reaches at the engine rate, and the subsample
+// it changes at follows from where the input crosses the threshold. Returns the states of the frame's RATIO
+// subsamples packed as in dsp/masks.hpp. Unlike an upsampled input there is no filter delay and no ringing, and a
+// frame without a crossing costs one trigger step.
+//
+// The thresholds apply to `in` as it is. Engines that trigger their upsampled inputs through an unnormalized kernel
+// divide them by SharedResamplerKernel::gain(), so that both front ends switch at the same input voltages.
+template <int RATIO>
+SubsampleMask edgeTimedStates(dsp::TSchmittTrigger<float_4>& trigger, float_4& previous, float_4 in,
+                              float lowThreshold, float highThreshold) {
+    static_assert(RATIO <= SUBSAMPLES_PER_MASK, "a frame of states has to fit in one mask");
+    int before = simd::movemask(trigger.isHigh());
+    trigger.process(in, lowThreshold, highThreshold);
+    int after = simd::movemask(trigger.isHigh());
+
+    SubsampleMask states = 0;
+    for (auto c = 0; c < 4; ++c) {
+        int first = RATIO;
+        if (((before ^ after) >> c) & 1) {
+            // subsample s sits at (s + 1) / RATIO of the way from the previous sample to this one
+            float fraction = 1.f + schmittCrossingPhase(previous[c], in[c], (after >> c) & 1,
+                                                        lowThreshold, highThreshold);
+            first = std::min(std::max(static_cast<int>(std::ceil(fraction * RATIO)) - 1, 0), RATIO - 1);
+        }
+        if ((before >> c) & 1) {
+            states |= laneSubsamples(c, 0, first);
+        }
+        if ((after >> c) & 1) {
+            states |= laneSubsamples(c, first, RATIO);
+        }
+    }
+    previous = in;
+    return states;
+}
+
+// Writes packed states of one frame as a movemask bitfield per subsample, for engines that keep them that way
+template <int RATIO>
+void unpackFrameStates(SubsampleMask states, int* high) {
+    for (auto s = 0; s < RATIO; ++s) {
+        high[s] = static_cast<int>((states >> (4 * s)) & 15);
+    }
+}
+
+// The rising edges in packed states of one frame, `before` being the state before the frame as a movemask bitfield
+inline SubsampleMask risingStates(SubsampleMask states, int before) {
+    return states & ~((states << 4) | static_cast<SubsampleMask>(before));
+}
+
+// How the oversampled engines of a module find the edges of their gate inputs. The menu writes the field and the
+// module rebuilds its engines with it.
+struct GateInputSettings {
+    // false upsamples the inputs and runs the triggers on every subsample
+    bool edgeTimed = false;
+
+    void toJson(json_t* root) const {
+        json_object_set_new(root, "edgeTimedInputs", json_boolean(edgeTimed));
+    }
+
+    void fromJson(json_t* root) {
+        json_t* edgeTimedJ = json_object_get(root, "edgeTimedInputs");
+        if (edgeTimedJ) {
+            edgeTimed = json_boolean_value(edgeTimedJ);
+        }
+    }
+};
+
+inline void appendGateInputMenu(Menu* menu, GateInputSettings* settings, std::function<void()> changed) {
+    menu->addChild(createIndexSubmenuItem("Gate inputs", {"Upsampled", "Edge-timed"},
+        [=]() -> size_t {
+            return settings->edgeTimed ? 1 : 0;
+        },
+        [=](size_t index) {
+            settings->edgeTimed = index == 1;
+            changed();
+        }));
+}
+
+#endif //SCHLAPPI_VCV_EDGES_H
@@ -0,0 +1,99 @@
+#ifndef SCHLAPPI_VCV_ENGINES_H
+#define SCHLAPPI_VCV_ENGINES_H
+
+#include <rack.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+using namespace rack;
+
+// What a module's process() runs on: one engine per group of four polyphony channels, the frame blocks of block mode
+// and the configuration they were built for. TConfig holds the settings that need new engines, blockSize among them,
+// and compares with ==.
+template <typename TEngine, typename TBlock, typename TConfig>
+struct EngineSet {
+    TConfig config;
+    std::array<std::unique_ptr<TEngine>, PORT_MAX_CHANNELS / 4> engines;
+    // frames buffered per group in block processing mode, only allocated while it is on
+    std::unique_ptr<std::array<TBlock, PORT_MAX_CHANNELS / 4>> frameBlocks;
+
+    explicit EngineSet(const TConfig& config) : config(config) {
+        if (config.blockSize > 0) {
+            frameBlocks.reset(new std::array<TBlock, PORT_MAX_CHANNELS / 4>);
+        }
+    }
+
+    size_t stateBytes() const {
+        size_t bytes = sizeof(*this);
+        for (auto& engine : engines) {
+            bytes += engine->stateBytes();
+        }
+        if (frameBlocks) {
+            bytes += sizeof(*frameBlocks);
+        }
+        return bytes;
+    }
+};
+
+// Hands engine sets from the threads that build them to the audio thread. Sets are built where settings change: in the
+// constructor, dataFromJson(), onSampleRateChange() and the context menu. process() never allocates or frees one, it
+// only swaps a finished set in with one atomic operation.
+//
+// The swap goes through a single slot. A builder puts its new set there and frees whatever the slot held before: a set
+// process() never got to, or the one process() swapped out last time, which process() leaves in the slot marked with
+// the low pointer bit. process() takes a set from the slot only while it is unmarked, so it never touches a set a
+// builder might be freeing.
+template <typename TSet>
+struct EngineHandoff {
+    // the set process() runs on, owned by the audio thread once the module is running
+    std::unique_ptr<TSet> current;
+    std::atomic<uintptr_t> slot{0};
+    // serializes builders and guards newest
+    std::mutex buildMutex;
+    const TSet* newest = nullptr;
+
+    ~EngineHandoff() {
+        delete fromSlot(slot.load());
+    }
+
+    static TSet* fromSlot(uintptr_t value) {
+        return reinterpret_cast<TSet*>(value & ~static_cast<uintptr_t>(1));
+    }
+
+    /** Builds a set with build(config) unless the newest set already has this configuration. Not for the audio
+     * thread. */
+    template <typename TConfig, typename TBuild>
+    void update(const TConfig& config, TBuild build) {
+        std::lock_guard<std::mutex> lock(buildMutex);
+        if (newest && newest->config == config) {
+            return;
+        }
+        TSet* set = build(config);
+        bool first = !newest;
+        newest = set;
+        if (first) {
+            // built in the constructor, before the module runs
+            current.reset(set);
+            return;
+        }
+        delete fromSlot(slot.exchange(reinterpret_cast<uintptr_t>(set), std::memory_order_acq_rel));
+    }
+
+    /** Called at the top of process(): switches to the newest set if one is waiting and returns the current one */
+    TSet& acquire() {
+        uintptr_t next = slot.load(std::memory_order_acquire);
+        if (next != 0 && !(next & 1)) {
+            uintptr_t retired = reinterpret_cast<uintptr_t>(current.get()) | 1;
+            if (slot.compare_exchange_strong(next, retired, std::memory_order_acq_rel)) {
+                current.release();
+                current.reset(reinterpret_cast<TSet*>(next));
+            }
+        }
+        return *current;
+    }
+};
+
+#endif //SCHLAPPI_VCV_ENGINES_H
@@ -0,0 +1,57 @@
+#ifndef SCHLAPPI_VCV_MASKS_H
+#define SCHLAPPI_VCV_MASKS_H
+
+#include <rack.hpp>
+#include <array>
+#include <cstdint>
+
+using simd::float_4;
+
+// Gate states of one group of four polyphony channels, packed 16 subsamples to a word: bit 4 * s + c is channel c of
+// subsample s. One word operation applies a logic function to 16 subsamples of all four channels, and each subsample is
+// the movemask of a float_4 comparison shifted into place.
+typedef uint64_t SubsampleMask;
+#define SUBSAMPLES_PER_MASK 16
+
+inline int subsampleMasks(int subsamples) {
+    return (subsamples + SUBSAMPLES_PER_MASK - 1) / SUBSAMPLES_PER_MASK;
+}
+
+// The channels of subsample s as a movemask bitfield
+inline int maskChannels(const SubsampleMask* masks, int s) {
+    return static_cast<int>((masks[s / SUBSAMPLES_PER_MASK] >> (4 * (s % SUBSAMPLES_PER_MASK))) & 15);
+}
+
+// Bit c of subsamples `first` up to `last`, exclusive, within one mask
+inline SubsampleMask laneSubsamples(int c, int first, int last) {
+    const SubsampleMask everySubsample = 0x1111111111111111ull;
+    if (first >= last) {
+        return 0;
+    }
+    SubsampleMask from = ~SubsampleMask(0) << (4 * first);
+    SubsampleMask below = last < SUBSAMPLES_PER_MASK ? ~(~SubsampleMask(0) << (4 * last)) : ~SubsampleMask(0);
+    return (everySubsample << c) & from & below;
+}
+
+// A movemask bitfield as 0 or 1 per lane
+inline const float_4& maskLevels(int channels) {
+    static const std::array<float_4, 16> levels = []() {
+        std::array<float_4, 16> l;
+        for (auto n = 0; n < 16; ++n) {
+            for (auto c = 0; c < 4; ++c) {
+                l[n][c] = (n >> c) & 1 ? 1.f : 0.f;
+            }
+        }
+        return l;
+    }();
+    return levels[channels];
+}
+
+// Writes the packed states as 0 or 1 per subsample
+inline void unpackMasks(const SubsampleMask* masks, int subsamples, float_4* out) {
+    for (auto s = 0; s < subsamples; ++s) {
+        out[s] = maskLevels(maskChannels(masks, s));
+    }
+}
+
+#endif //SCHLAPPI_VCV_MASKS_H
@@ -0,0 +1,65 @@
+#ifndef SCHLAPPI_VCV_MINBLEP_H
+#define SCHLAPPI_VCV_MINBLEP_H
+
+#include <rack.hpp>
+#include <algorithm>
+
+using namespace rack;
+
+// The step table of dsp::MinBlepGenerator. It only depends on the zero crossings and the table oversampling, so all
+// generators of one size share a copy, computed by whichever thread asks for it first.
+template <int Z, int O>
+struct SharedMinBlepImpulse {
+    float impulse[2 * Z * O + 1];
+
+    SharedMinBlepImpulse() {
+        dsp::minBlepImpulse(Z, O, impulse);
+        impulse[2 * Z * O] = 1.f;
+    }
+
+    static const float* get() {
+        static const SharedMinBlepImpulse table;
+        return table.impulse;
+    }
+};
+
+// dsp::MinBlepGenerator reading the shared table, which the stock generator builds with an FFT in every instance and
+// keeps a copy of
+template <int Z, int O, typename T = float>
+struct SharedMinBlepGenerator {
+    T buf[2 * Z];
+    int pos = 0;
+    const float* impulse;
+
+    SharedMinBlepGenerator() : impulse(SharedMinBlepImpulse<Z, O>::get()) {
+        reset();
+    }
+
+    void reset() {
+        pos = 0;
+        std::fill(std::begin(buf), std::end(buf), T(0.f));
+    }
+
+    /** Places a discontinuity of height x at phase p in (-1, 0] relative to the current sample */
+    void insertDiscontinuity(float p, T x) {
+        if (!(-1 < p && p <= 0)) {
+            return;
+        }
+        for (int j = 0; j < 2 * Z; j++) {
+            float minBlepIndex = ((float) j - p) * O;
+            int index = (int) minBlepIndex;
+            float frac = minBlepIndex - index;
+            float value = math::crossfade(impulse[index], impulse[index + 1], frac);
+            buf[(pos + j) % (2 * Z)] += x * (-1.f + value);
+        }
+    }
+
+    T process() {
+        T v = buf[pos];
+        buf[pos] = T(0.f);
+        pos = (pos + 1) % (2 * Z);
+        return v;
+    }
+};
+
+#endif //SCHLAPPI_VCV_MINBLEP_H
@@ -0,0 +1,157 @@
+#ifndef SCHLAPPI_VCV_OVERSAMPLING_H
+#define SCHLAPPI_VCV_OVERSAMPLING_H
+
+#include <rack.hpp>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace rack;
+
+// Oversampling ratios and filter qualities (taps per input sample) the engines are compiled for. Builds for
+// constrained targets like the MetaModule define SCHLAPPI_LOW_COST, which drops the expensive ones. Patches asking for
+// more load with the highest available setting.
+#ifdef SCHLAPPI_LOW_COST
+static const int OVERSAMPLING_RATIOS[] = {1, 2, 4};
+static const int OVERSAMPLING_QUALITIES[] = {4};
+static const char* const OVERSAMPLING_QUALITY_NAMES[] = {"Low"};
+#define OVERSAMPLING_MAX_RATIO 4
+#define OVERSAMPLING_MAX_QUALITY 4
+#else
+static const int OVERSAMPLING_RATIOS[] = {1, 2, 4, 8, 16};
+static const int OVERSAMPLING_QUALITIES[] = {4, 8, 12};
+static const char* const OVERSAMPLING_QUALITY_NAMES[] = {"Low", "Medium", "High"};
+#define OVERSAMPLING_MAX_RATIO 16
+#define OVERSAMPLING_MAX_QUALITY 12
+#endif
+#define OVERSAMPLING_NUM_RATIOS (sizeof(OVERSAMPLING_RATIOS) / sizeof(OVERSAMPLING_RATIOS[0]))
+#define OVERSAMPLING_NUM_QUALITIES (sizeof(OVERSAMPLING_QUALITIES) / sizeof(OVERSAMPLING_QUALITIES[0]))
+
+// The ratios in the module sources were chosen for this engine rate
+#define OVERSAMPLING_REFERENCE_RATE 48000.f
+
+// Per-module oversampling choice from the context menu. The menu writes these fields and tells the module, which
+// rebuilds its engines right there and hands them to the audio thread.
+struct OversamplingSettings {
+    // 0 selects a ratio from the engine sample rate
+    int ratio = 0;
+    // filter taps per input sample, one of OVERSAMPLING_QUALITIES
+    int quality;
+
+    explicit OversamplingSettings(int defaultQuality) : quality(std::min(defaultQuality, OVERSAMPLING_MAX_QUALITY)) {}
+
+    // Keeps the oversampled rate close to what defaultRatio gives at the reference rate, so 96 and 192 kHz engines do
+    // not pay for oversampling they do not need
+    static int autoRatio(float sampleRate, int defaultRatio) {
+        float ideal = defaultRatio * OVERSAMPLING_REFERENCE_RATE / sampleRate;
+        int ratio = 1 << static_cast<int>(std::round(std::log2(std::max(ideal, 1.f))));
+        return std::min(std::max(ratio, 1), OVERSAMPLING_MAX_RATIO);
+    }
+
+    int resolveRatio(float sampleRate, int defaultRatio) const {
+        return ratio > 0 ? ratio : autoRatio(sampleRate, defaultRatio);
+    }
+
+    void toJson(json_t* root) const {
+        json_object_set_new(root, "oversampling", json_integer(ratio));
+        json_object_set_new(root, "oversamplingQuality", json_integer(quality));
+    }
+
+    void fromJson(json_t* root) {
+        json_t* ratioJ = json_object_get(root, "oversampling");
+        if (ratioJ) {
+            int r = json_integer_value(ratioJ);
+            ratio = (r == 1 || r == 2 || r == 4 || r == 8 || r == 16) ? std::min(r, OVERSAMPLING_MAX_RATIO) : 0;
+        }
+        json_t* qualityJ = json_object_get(root, "oversamplingQuality");
+        if (qualityJ) {
+            int q = json_integer_value(qualityJ);
+            quality = (q == 4 || q == 8 || q == 12) ? std::min(q, OVERSAMPLING_MAX_QUALITY) : quality;
+        }
+    }
+};
+
+// Instantiates TEngine<RATIO, QUALITY> for a ratio and quality chosen at runtime
+template <typename TBase, template <int, int> class TEngine, int QUALITY>
+TBase* createOversampledEngine(int ratio) {
+    switch (ratio) {
+        case 1: return new TEngine<1, QUALITY>;
+        case 2: return new TEngine<2, QUALITY>;
+#if OVERSAMPLING_MAX_RATIO > 4
+        case 4: return new TEngine<4, QUALITY>;
+        case 8: return new TEngine<8, QUALITY>;
+        default: return new TEngine<16, QUALITY>;
+#else
+        default: return new TEngine<4, QUALITY>;
+#endif
+    }
+}
+
+template <typename TBase, template <int, int> class TEngine>
+TBase* createOversampledEngine(int ratio, int quality) {
+#if OVERSAMPLING_MAX_QUALITY > 4
+    switch (quality) {
+        case 4: return createOversampledEngine<TBase, TEngine, 4>(ratio);
+        case 8: return createOversampledEngine<TBase, TEngine, 8>(ratio);
+        default: return createOversampledEngine<TBase, TEngine, 12>(ratio);
+    }
+#else
+    return createOversampledEngine<TBase, TEngine, 4>(ratio);
+#endif
+}
+
+// Instantiates TEngine<RATIO, QUALITY> for a fixed ratio and a quality chosen at runtime
+template <int RATIO, typename TBase, template <int, int> class TEngine>
+TBase* createEngineWithQuality(int quality) {
+#if OVERSAMPLING_MAX_QUALITY > 4
+    switch (quality) {
+        case 4: return new TEngine<RATIO, 4>;
+        case 8: return new TEngine<RATIO, 8>;
+        default: return new TEngine<RATIO, 12>;
+    }
+#else
+    return new TEngine<RATIO, 4>;
+#endif
+}
+
+// changed() runs after either setting was picked
+inline void appendOversamplingMenu(Menu* menu, OversamplingSettings* settings, float sampleRate, int defaultRatio,
+                                   std::function<void()> changed) {
+    std::vector<std::string> ratioLabels = {
+        string::f("Auto (%dx)", OversamplingSettings::autoRatio(sampleRate, defaultRatio))
+    };
+    for (auto r : OVERSAMPLING_RATIOS) {
+        ratioLabels.push_back(string::f("%dx", r));
+    }
+    menu->addChild(createIndexSubmenuItem("Oversampling", ratioLabels,
+        [=]() -> size_t {
+            for (size_t i = 0; i < OVERSAMPLING_NUM_RATIOS; ++i) {
+                if (OVERSAMPLING_RATIOS[i] == settings->ratio) {
+                    return i + 1;
+                }
+            }
+            return 0;
+        },
+        [=](size_t index) {
+            settings->ratio = index == 0 ? 0 : OVERSAMPLING_RATIOS[index - 1];
+            changed();
+        }));
+
+    std::vector<std::string> qualityLabels(std::begin(OVERSAMPLING_QUALITY_NAMES), std::end(OVERSAMPLING_QUALITY_NAMES));
+    menu->addChild(createIndexSubmenuItem("Filter quality", qualityLabels,
+        [=]() -> size_t {
+            for (size_t i = 0; i < OVERSAMPLING_NUM_QUALITIES; ++i) {
+                if (OVERSAMPLING_QUALITIES[i] == settings->quality) {
+                    return i;
+                }
+            }
+            return 0;
+        },
+        [=](size_t index) {
+            settings->quality = OVERSAMPLING_QUALITIES[index];
+            changed();
+        }));
+}
+
+#endif //SCHLAPPI_VCV_OVERSAMPLING_H
@@ -0,0 +1,154 @@
+#ifndef SCHLAPPI_VCV_PIPELINE_H
+#define SCHLAPPI_VCV_PIPELINE_H
+
+#include <rack.hpp>
+#include "resampler.hpp"
+#include "block.hpp"
+#include "static_input.hpp"
+#include "profiling.hpp"
+#include <array>
+
+using namespace rack;
+using simd::float_4;
+
+// Subsamples of one chunk of an OversampledPipeline, shared by all pipelines of the same shape on a thread
+template <int NUM_INPUTS, int NUM_OUTPUTS>
+struct PipelineBuffers {
+    std::array<std::array<float_4, BLOCK_CHUNK_MAX_SUBSAMPLES>, NUM_INPUTS> inputs;
+    std::array<std::array<float_4, BLOCK_CHUNK_MAX_SUBSAMPLES>, NUM_OUTPUTS> outputs;
+};
+
+// The upsample -> kernel -> decimate chain of an oversampled engine, with static input skipping and block processing
+// in chunks of up to BLOCK_CHUNK_FRAMES. Engines hold one and pass themselves as the kernel, so the kernel is inlined
+// into the chunk loop. A kernel provides
+//
+//   bool upsampleInputs() const
+//       false when it finds its subsamples without the upsamplers, e.g. from edge-timed inputs
+//   void staticCheck(std::array<float_4, NUM_INPUTS>& check) const
+//       edits what the static input check compares for a frame, which starts out as the frame's inputs, e.g. for an
+//       input that can change while its voltage does not
+//   int chunkFrames() const
+//       how many frames a chunk of block processing may hold, at most BLOCK_CHUNK_FRAMES
+//   void processSubsamples(const std::array<const float_4*, NUM_INPUTS>& in, int frames,
+//                          const std::array<float_4*, NUM_INPUTS>& upsampled,
+//                          const std::array<float_4*, NUM_OUTPUTS>& out)
+//       turns frames * RATIO upsampled inputs into as many subsamples of each output, `in` being the frames they came
+//       from. It may overwrite the upsampled inputs.
+//
+// The engine keeps the outputs of the last frame in its own fields and hands the pipeline pointers to them, which it
+// updates after each chunk and repeats while the inputs are static.
+//
+// TOutputStage turns the output subsamples into frames. It is a PolyDecimatorBank unless the engine brings its own with
+// the same process() signature.
+template <int RATIO, int QUALITY, int NUM_INPUTS, int NUM_OUTPUTS,
+          typename TOutputStage = PolyDecimatorBank<RATIO, QUALITY, NUM_OUTPUTS>>
+struct OversampledPipeline {
+    typedef std::array<float_4, NUM_INPUTS> Frame;
+    typedef std::array<const float_4*, NUM_INPUTS> Inputs;
+    typedef std::array<float_4*, NUM_OUTPUTS> Outputs;
+
+    PolyUpsamplerBank<RATIO, QUALITY, NUM_INPUTS> upsamplers;
+    TOutputStage outputStage;
+
+    StaticInputDetector<NUM_INPUTS> staticInputs;
+
+    // The upsampler cutoff and whether its kernel is normalized to unity gain, e.g. to set trigger thresholds against
+    // the unnormalized gain. The output stage is default constructed.
+    OversampledPipeline(float upsamplerCutoff, bool upsamplerNormalized)
+            : upsamplers(upsamplerCutoff, upsamplerNormalized) {
+        // upsampler history, one sample for the kernel, decimator history; engines whose kernel holds more state add
+        // to it
+        staticInputs.settleFrames = 2 * QUALITY + 1;
+    }
+
+    // Same with the cutoff of the decimators
+    OversampledPipeline(float upsamplerCutoff, bool upsamplerNormalized, float decimatorCutoff)
+            : upsamplers(upsamplerCutoff, upsamplerNormalized), outputStage(decimatorCutoff) {
+        staticInputs.settleFrames = 2 * QUALITY + 1;
+    }
+
+    // Processes one frame into the held outputs, or leaves them as they are once the static input check has been
+    // unchanged long enough for the chain to settle
+    template <typename TKernel>
+    void process(const Frame& in, TKernel& kernel, const Outputs& held) {
+        Frame check = in;
+        kernel.staticCheck(check);
+        if (staticInputs.process(check)) {
+            return;
+        }
+        Inputs frame;
+        for (auto i = 0; i < NUM_INPUTS; ++i) {
+            frame[i] = &in[i];
+        }
+        run(frame, 1, kernel, held, held);
+    }
+
+    // Processes a full block in place. A chunk is only skipped when every one of its frames could have been.
+    template <typename TKernel>
+    void processBlock(FrameBlock<NUM_INPUTS, NUM_OUTPUTS>& block, int frames, TKernel& kernel, const Outputs& held) {
+        Frame check;
+        int n;
+        for (auto start = 0; start < frames; start += n) {
+            n = std::min(kernel.chunkFrames(), frames - start);
+
+            bool settled = true;
+            for (auto f = start; f < start + n; ++f) {
+                for (auto i = 0; i < NUM_INPUTS; ++i) {
+                    check[i] = block.inputs[i][f];
+                }
+                kernel.staticCheck(check);
+                settled &= staticInputs.process(check);
+            }
+            if (settled) {
+                for (auto f = start; f < start + n; ++f) {
+                    for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+                        block.outputs[o][f] = *held[o];
+                    }
+                }
+                continue;
+            }
+
+            Inputs in;
+            for (auto i = 0; i < NUM_INPUTS; ++i) {
+                in[i] = &block.inputs[i][start];
+            }
+            Outputs out;
+            for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+                out[o] = &block.outputs[o][start];
+            }
+            run(in, n, kernel, out, held);
+        }
+    }
+
+    // Runs the chain over `frames` frames, at most BLOCK_CHUNK_FRAMES, and copies the last frame to the held outputs
+    template <typename TKernel>
+    void run(const Inputs& in, int frames, TKernel& kernel, const Outputs& out, const Outputs& held) {
+        auto& buffers = chunkBuffers<PipelineBuffers<NUM_INPUTS, NUM_OUTPUTS>>();
+        std::array<float_4*, NUM_INPUTS> upsampled;
+        for (auto i = 0; i < NUM_INPUTS; ++i) {
+            upsampled[i] = buffers.inputs[i].data();
+        }
+        Outputs subsamples;
+        std::array<const float_4*, NUM_OUTPUTS> outputStageIn;
+        for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+            subsamples[o] = buffers.outputs[o].data();
+            outputStageIn[o] = buffers.outputs[o].data();
+        }
+
+        PROFILE_START();
+        if (kernel.upsampleInputs()) {
+            upsamplers.process(in, frames, upsampled);
+        }
+        PROFILE_LAP(PROFILE_UPSAMPLE);
+        kernel.processSubsamples(in, frames, upsampled, subsamples);
+        PROFILE_LAP(PROFILE_CORE);
+        outputStage.process(outputStageIn, frames, out);
+        PROFILE_LAP(PROFILE_OUTPUT);
+
+        for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+            *held[o] = out[o][frames - 1];
+        }
+    }
+};
+
+#endif //SCHLAPPI_VCV_PIPELINE_H
@@ -0,0 +1,183 @@
+#ifndef SCHLAPPI_VCV_PROFILING_H
+#define SCHLAPPI_VCV_PROFILING_H
+
+// Per-stage cost counters for process(), compiled in by building with -DSCHLAPPI_PROFILE (`make PROFILE=1`). Without
+// it the macros below expand to nothing and no profiling state exists.
+//
+// A module opens a frame with PROFILE_FRAME(profile) at the top of process(). Code it calls, engines included, marks
+// where its stages end with PROFILE_START() and PROFILE_LAP(stage): each lap is charged the time since the previous one.
+// Time in process() that no lap claims shows up as "Other".
+
+// Stages the modules are broken down into
+enum ProfileStage {
+    // upsampling the inputs
+    PROFILE_UPSAMPLE,
+    // quantizer, Schmitt triggers, gate logic and the nibble register
+    PROFILE_CORE,
+    // decimators and minBLEP output stages
+    PROFILE_OUTPUT,
+    PROFILE_LIGHTS,
+    PROFILE_STAGES
+};
+
+#ifdef SCHLAPPI_PROFILE
+
+#include <rack.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace rack;
+
+static const char* const PROFILE_STAGE_NAMES[] = {"Upsampling", "Triggers and logic", "Output filtering", "Lights"};
+
+// Cycles where the CPU has a cheap cycle counter, nanoseconds elsewhere
+#if defined(__x86_64__) || defined(__i386__)
+#define PROFILE_TICK_UNIT "cycles"
+inline uint64_t profileTicks() {
+    return __rdtsc();
+}
+#else
+#define PROFILE_TICK_UNIT "ns"
+inline uint64_t profileTicks() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+// Running totals and per-frame maxima of each stage of one module. The audio thread is the only writer, the UI thread
+// reads them for the context menu and the log.
+struct ModuleProfile {
+    struct Stat {
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> max{0};
+    };
+
+    // the stages, then all of process()
+    std::array<Stat, PROFILE_STAGES + 1> stats;
+    std::atomic<uint64_t> frames{0};
+    std::atomic<bool> resetRequested{false};
+
+    // audio thread, ticks charged to each stage in the current frame
+    std::array<uint64_t, PROFILE_STAGES> frameTicks{};
+
+    void endFrame(uint64_t processTicks) {
+        if (resetRequested.exchange(false, std::memory_order_relaxed)) {
+            for (auto& stat : stats) {
+                stat.total.store(0, std::memory_order_relaxed);
+                stat.max.store(0, std::memory_order_relaxed);
+            }
+            frames.store(0, std::memory_order_relaxed);
+        }
+        for (auto s = 0; s < PROFILE_STAGES; ++s) {
+            add(stats[s], frameTicks[s]);
+            frameTicks[s] = 0;
+        }
+        add(stats[PROFILE_STAGES], processTicks);
+        frames.store(frames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static void add(Stat& stat, uint64_t ticks) {
+        stat.total.store(stat.total.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+        if (ticks > stat.max.load(std::memory_order_relaxed)) {
+            stat.max.store(ticks, std::memory_order_relaxed);
+        }
+    }
+
+    double mean(int s) const {
+        uint64_t n = frames.load(std::memory_order_relaxed);
+        return n > 0 ? static_cast<double>(stats[s].total.load(std::memory_order_relaxed)) / n : 0.;
+    }
+
+    // one line per stage, "Other" is what no stage claimed
+    std::string line(int s) const {
+        double m = mean(s);
+        if (s == PROFILE_STAGES) {
+            double claimed = 0.;
+            for (auto i = 0; i < PROFILE_STAGES; ++i) {
+                claimed += mean(i);
+            }
+            return string::f("process(): mean %.0f, max %llu " PROFILE_TICK_UNIT "/frame, other %.0f", m,
+                             static_cast<unsigned long long>(stats[s].max.load(std::memory_order_relaxed)),
+                             std::max(m - claimed, 0.));
+        }
+        return string::f("%s: mean %.0f, max %llu " PROFILE_TICK_UNIT "/frame", PROFILE_STAGE_NAMES[s], m,
+                         static_cast<unsigned long long>(stats[s].max.load(std::memory_order_relaxed)));
+    }
+
+    void log(const std::string& name) const {
+        INFO("%s profile over %llu frames", name.c_str(),
+             static_cast<unsigned long long>(frames.load(std::memory_order_relaxed)));
+        for (auto s = 0; s <= PROFILE_STAGES; ++s) {
+            INFO("%s %s", name.c_str(), line(s).c_str());
+        }
+    }
+};
+
+// The profile of the module whose process() is running on this thread
+inline ModuleProfile*& currentProfile() {
+    static thread_local ModuleProfile* profile = nullptr;
+    return profile;
+}
+
+struct ProfileFrame {
+    ModuleProfile& profile;
+    uint64_t start;
+
+    explicit ProfileFrame(ModuleProfile& profile) : profile(profile), start(profileTicks()) {
+        currentProfile() = &profile;
+    }
+
+    ~ProfileFrame() {
+        profile.endFrame(profileTicks() - start);
+        currentProfile() = nullptr;
+    }
+};
+
+struct ProfileLap {
+    uint64_t last = profileTicks();
+
+    void record(ProfileStage stage) {
+        uint64_t now = profileTicks();
+        if (auto profile = currentProfile()) {
+            profile->frameTicks[stage] += now - last;
+        }
+        last = now;
+    }
+};
+
+inline void appendProfileMenu(Menu* menu, ModuleProfile* profile, const std::string& name) {
+    menu->addChild(createSubmenuItem("Profile", "", [=](Menu* menu) {
+        menu->addChild(createMenuLabel(string::f("%llu frames",
+                static_cast<unsigned long long>(profile->frames.load(std::memory_order_relaxed)))));
+        for (auto s = 0; s <= PROFILE_STAGES; ++s) {
+            menu->addChild(createMenuLabel(profile->line(s)));
+        }
+        menu->addChild(createMenuItem("Dump to log", "", [=]() {
+            profile->log(name);
+        }));
+        menu->addChild(createMenuItem("Reset", "", [=]() {
+            profile->resetRequested.store(true, std::memory_order_relaxed);
+        }));
+    }));
+}
+
+#define PROFILE_FRAME(profile) ProfileFrame profileFrame_(profile)
+#define PROFILE_START() ProfileLap profileLap_
+#define PROFILE_LAP(stage) profileLap_.record(stage)
+
+#else
+
+#define PROFILE_FRAME(profile)
+#define PROFILE_START()
+#define PROFILE_LAP(stage)
+
+#endif
+
+#endif //SCHLAPPI_VCV_PROFILING_H
@@ -0,0 +1,189 @@
+#ifndef SCHLAPPI_VCV_RESAMPLER_H
+#define SCHLAPPI_VCV_RESAMPLER_H
+
+#include <rack.hpp>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace rack;
+using simd::float_4;
+
+// Fills a windowed-sinc kernel the same way rack::dsp::Upsampler and rack::dsp::Decimator do. Without oversampling
+// there is nothing to filter, so the kernel becomes a unit impulse and the resamplers pass their input straight through.
+template <int OVERSAMPLE, int QUALITY>
+void makeResamplerKernel(float* kernel, float cutoff) {
+    if (OVERSAMPLE == 1) {
+        std::fill(kernel, kernel + QUALITY, 0.f);
+        kernel[0] = 1.f;
+        return;
+    }
+    dsp::boxcarLowpassIR(kernel, OVERSAMPLE * QUALITY, cutoff * 0.5f / OVERSAMPLE);
+    dsp::blackmanHarrisWindow(kernel, OVERSAMPLE * QUALITY);
+}
+
+// Resampler kernels are immutable, so every resampler with the same ratio, quality and cutoff points at one copy that
+// is computed the first time any instance asks for it. Normalized kernels are divided by their sum, which gives the
+// upsamplers and decimators unity gain at DC: a 10V gate comes out of the chain at 10V without per-instance
+// compensation. The others keep the gain of the rack::dsp kernels, which the trigger thresholds were tuned against.
+template <int OVERSAMPLE, int QUALITY>
+struct SharedResamplerKernel {
+    float cutoff;
+    bool normalized;
+    float taps[OVERSAMPLE * QUALITY];
+
+    /** Modules and engines can be built on several threads at once, so lookups are serialized. Only constructors
+     * call this. */
+    static const float* get(float cutoff, bool normalized) {
+        static std::mutex mutex;
+        static std::vector<std::unique_ptr<SharedResamplerKernel>> kernels;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& kernel : kernels) {
+            if (kernel->cutoff == cutoff && kernel->normalized == normalized) {
+                return kernel->taps;
+            }
+        }
+
+        std::unique_ptr<SharedResamplerKernel> kernel(new SharedResamplerKernel);
+        kernel->cutoff = cutoff;
+        kernel->normalized = normalized;
+        makeResamplerKernel<OVERSAMPLE, QUALITY>(kernel->taps, cutoff);
+        if (normalized) {
+            float sum = 0.f;
+            for (auto t : kernel->taps) {
+                sum += t;
+            }
+            for (auto& t : kernel->taps) {
+                t /= sum;
+            }
+        }
+        kernels.push_back(std::move(kernel));
+        return kernels.back()->taps;
+    }
+
+    /** DC gain of the unnormalized kernel, the level the rack::dsp resamplers pass a constant signal at */
+    static float gain(float cutoff) {
+        const float* taps = get(cutoff, false);
+        float sum = 0.f;
+        for (int i = 0; i < OVERSAMPLE * QUALITY; ++i) {
+            sum += taps[i];
+        }
+        return sum;
+    }
+};
+
+// Same polyphase FIR as rack::dsp::Upsampler, for CHANNELS signals of four polyphony channels each that share one
+// kernel. The history is stored structure-of-arrays, all signals of one input sample next to each other, so every
+// kernel coefficient is loaded once and applied to all signals in a run of SIMD multiply-adds.
+template <int OVERSAMPLE, int QUALITY, int CHANNELS, typename T = float_4>
+struct PolyUpsamplerBank {
+    T inBuffer[QUALITY][CHANNELS];
+    const float* kernel;
+    int inIndex;
+
+    PolyUpsamplerBank(float cutoff = 0.9f, bool normalized = true)
+            : kernel(SharedResamplerKernel<OVERSAMPLE, QUALITY>::get(cutoff, normalized)) {
+        reset();
+    }
+
+    void reset() {
+        inIndex = 0;
+        for (auto& samples : inBuffer) {
+            std::fill(std::begin(samples), std::end(samples), T(0.f));
+        }
+    }
+
+    /** Upsamples `frames` samples of every signal, `out[ch]` must be length OVERSAMPLE * frames. The taps are read in
+     * two runs split where the ring buffer wraps, so the inner loops need no modulo. */
+    void process(const std::array<const T*, CHANNELS>& in, int frames, const std::array<T*, CHANNELS>& out) {
+        for (int f = 0; f < frames; f++) {
+            for (int ch = 0; ch < CHANNELS; ch++) {
+                inBuffer[inIndex][ch] = OVERSAMPLE * in[ch][f];
+            }
+            inIndex++;
+            if (inIndex == QUALITY) {
+                inIndex = 0;
+            }
+
+            for (int i = 0; i < OVERSAMPLE; i++) {
+                T y[CHANNELS];
+                std::fill(std::begin(y), std::end(y), T(0.f));
+                for (int j = 0; j < inIndex; j++) {
+                    accumulate(y, kernel[OVERSAMPLE * j + i], inBuffer[inIndex - 1 - j]);
+                }
+                for (int j = inIndex; j < QUALITY; j++) {
+                    accumulate(y, kernel[OVERSAMPLE * j + i], inBuffer[inIndex + QUALITY - 1 - j]);
+                }
+                for (int ch = 0; ch < CHANNELS; ch++) {
+                    out[ch][f * OVERSAMPLE + i] = y[ch];
+                }
+            }
+        }
+    }
+
+    static void accumulate(T* y, float k, const T* samples) {
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            y[ch] += k * samples[ch];
+        }
+    }
+};
+
+// rack::dsp::Decimator with the kernel from makeResamplerKernel, so that it also works without oversampling, for
+// CHANNELS signals that share one kernel. Stored structure-of-arrays like PolyUpsamplerBank.
+template <int OVERSAMPLE, int QUALITY, int CHANNELS, typename T = float_4>
+struct PolyDecimatorBank {
+    T inBuffer[OVERSAMPLE * QUALITY][CHANNELS];
+    const float* kernel;
+    int inIndex;
+
+    PolyDecimatorBank(float cutoff = 0.9f, bool normalized = true)
+            : kernel(SharedResamplerKernel<OVERSAMPLE, QUALITY>::get(cutoff, normalized)) {
+        reset();
+    }
+
+    void reset() {
+        inIndex = 0;
+        for (auto& samples : inBuffer) {
+            std::fill(std::begin(samples), std::end(samples), T(0.f));
+        }
+    }
+
+    /** Decimates every signal to `frames` samples, `in[ch]` must be length OVERSAMPLE * frames. The taps are split
+     * where the ring buffer wraps like in PolyUpsamplerBank::process(). */
+    void process(const std::array<const T*, CHANNELS>& in, int frames, const std::array<T*, CHANNELS>& out) {
+        const int length = OVERSAMPLE * QUALITY;
+        for (int f = 0; f < frames; f++) {
+            for (int i = 0; i < OVERSAMPLE; i++) {
+                for (int ch = 0; ch < CHANNELS; ch++) {
+                    inBuffer[inIndex + i][ch] = in[ch][f * OVERSAMPLE + i];
+                }
+            }
+            inIndex += OVERSAMPLE;
+            if (inIndex == length) {
+                inIndex = 0;
+            }
+
+            T y[CHANNELS];
+            std::fill(std::begin(y), std::end(y), T(0.f));
+            for (int i = 0; i < inIndex; i++) {
+                accumulate(y, kernel[i], inBuffer[inIndex - 1 - i]);
+            }
+            for (int i = inIndex; i < length; i++) {
+                accumulate(y, kernel[i], inBuffer[inIndex + length - 1 - i]);
+            }
+            for (int ch = 0; ch < CHANNELS; ch++) {
+                out[ch][f] = y[ch];
+            }
+        }
+    }
+
+    static void accumulate(T* y, float k, const T* samples) {
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            y[ch] += k * samples[ch];
+        }
+    }
+};
+
+#endif //SCHLAPPI_VCV_RESAMPLER_H
@@ -0,0 +1,60 @@
+#ifndef SCHLAPPI_VCV_STATIC_INPUT_H
+#define SCHLAPPI_VCV_STATIC_INPUT_H
+
+#include <rack.hpp>
+#include <array>
+
+using namespace rack;
+using simd::float_4;
+
+// Tells an oversampled engine when it can skip its upsample -> logic -> decimate chain. Once the inputs have not changed
+// for settleFrames calls in a row, the upsampler histories hold a constant, the per-subsample values repeat every input
+// sample, the trigger and counter states have reached a fixed point and the decimator histories have been refilled with
+// that repeating pattern. From then on the chain would produce exactly the outputs of the previous call again.
+//
+// The phases of a polyphase upsampler only differ in gain by a few percent, so a constant input can not straddle the
+// hysteresis band of a Schmitt trigger and keep producing edges.
+template <int NUM_INPUTS>
+struct StaticInputDetector {
+    std::array<float_4, NUM_INPUTS> previous;
+    int staticFrames = 0;
+    // how many calls the chain needs to settle after its last input change
+    int settleFrames = 1;
+
+    StaticInputDetector() {
+        for (auto& p : previous) { p = 0.f; }
+    }
+
+    void reset() {
+        staticFrames = 0;
+    }
+
+    bool settled() const {
+        return staticFrames >= settleFrames;
+    }
+
+    /** Whether process() would see these inputs as unchanged, without counting them */
+    bool matches(const std::array<float_4, NUM_INPUTS>& inputs) const {
+        int equal = 0xf;
+        for (auto i = 0; i < NUM_INPUTS; ++i) {
+            equal &= simd::movemask(inputs[i] == previous[i]);
+        }
+        return equal == 0xf;
+    }
+
+    /** Returns true when the chain has settled on these inputs and processing can be skipped */
+    bool process(const std::array<float_4, NUM_INPUTS>& inputs) {
+        if (!matches(inputs)) {
+            previous = inputs;
+            staticFrames = 0;
+            return false;
+        }
+        if (staticFrames < settleFrames) {
+            ++staticFrames;
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif //SCHLAPPI_VCV_STATIC_INPUT_H
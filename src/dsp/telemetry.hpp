@@ -0,0 +1,92 @@
+#ifndef SCHLAPPI_VCV_TELEMETRY_H
+#define SCHLAPPI_VCV_TELEMETRY_H
+
+#include <rack.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+using namespace rack;
+
+// Lights and the bit history are updated once every this many frames instead of every frame
+#define TELEMETRY_DIVISION 16
+// entries the bit history keeps, about 340 ms at 48 kHz
+#define TELEMETRY_HISTORY_LENGTH 1024
+
+// One entry of the bit history: the output bits of the first channel in the low byte, the step output scaled to
+// 0..255 in the high byte
+typedef uint16_t BitState;
+
+inline BitState packBitState(int bits, float step) {
+    int level = static_cast<int>(std::round(std::min(std::max(step, 0.f), 1.f) * 255.f));
+    return static_cast<BitState>((bits & 0xff) | (level << 8));
+}
+
+inline int bitStateBits(BitState state) {
+    return state & 0xff;
+}
+
+inline float bitStateStep(BitState state) {
+    return (state >> 8) * (1.f / 255.f);
+}
+
+// Single producer, single consumer ring buffer from the audio thread to the UI. The entries are atomics small enough to
+// be lock-free, so push() and read() never block or allocate, and a reader that is lapped by the writer only sees
+// newer entries than it expected.
+template <typename T, int N>
+struct TelemetryRing {
+    static_assert((N & (N - 1)) == 0, "the length has to be a power of two");
+
+    std::array<std::atomic<T>, N> entries;
+    std::atomic<uint32_t> written{0};
+
+    TelemetryRing() {
+        for (auto& entry : entries) {
+            entry.store(T(), std::memory_order_relaxed);
+        }
+    }
+
+    // audio thread
+    void push(T entry) {
+        uint32_t w = written.load(std::memory_order_relaxed);
+        entries[w & (N - 1)].store(entry, std::memory_order_relaxed);
+        written.store(w + 1, std::memory_order_release);
+    }
+
+    // UI thread, copies the newest count entries oldest first and returns how many there were
+    int read(T* out, int count) const {
+        uint32_t w = written.load(std::memory_order_acquire);
+        count = static_cast<int>(std::min<uint32_t>(std::min(count, N), w));
+        for (auto i = 0; i < count; ++i) {
+            out[i] = entries[(w - count + i) & (N - 1)].load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+};
+
+typedef TelemetryRing<BitState, TELEMETRY_HISTORY_LENGTH> BitHistory;
+
+// Optional panel display of the bit history, switched from the context menu. The module always records the history,
+// the setting only decides whether the widget draws it.
+struct BitHistorySettings {
+    bool visible = false;
+
+    void toJson(json_t* root) const {
+        json_object_set_new(root, "bitHistory", json_boolean(visible));
+    }
+
+    void fromJson(json_t* root) {
+        json_t* visibleJ = json_object_get(root, "bitHistory");
+        if (visibleJ) {
+            visible = json_boolean_value(visibleJ);
+        }
+    }
+};
+
+inline void appendBitHistoryMenu(Menu* menu, BitHistorySettings* settings) {
+    menu->addChild(createBoolPtrMenuItem("Bit history display", "", &settings->visible));
+}
+
+#endif //SCHLAPPI_VCV_TELEMETRY_H
@@ -1,30 +1,44 @@
 #include "plugin.hpp"
 #include "widgets/schlappi_widgets.hpp"
+#include "dsp/resampler.hpp"
+#include "dsp/oversampling.hpp"
+#include "dsp/static_input.hpp"
+#include "dsp/block.hpp"
+#include "dsp/pipeline.hpp"
+#include "dsp/engines.hpp"
+#include "dsp/bus.hpp"
+#include "dsp/edges.hpp"
+#include "dsp/minblep.hpp"
+#include "dsp/telemetry.hpp"
+#include "dsp/profiling.hpp"
 #include <array>
 
 
+// defaults, the context menu can pick another ratio and quality
 #define NIBBLER_UPSAMPLE_RATIO 16
 #define NIBBLER_UPSAMPLE_QUALITY 4
 #define NIBBLER_NUM_BITS 4
+#define NIBBLER_UPSAMPLER_CUTOFF 0.7f
+// volts per step of STEP and OFFSET STEP, every output stage comes out at this level
+#define NIBBLER_STEP_VOLTS (10.f / 16.f)
+// Nibblers in one cascade, the leader and up to three followers make a 16 bit register
+#define NIBBLER_MAX_CASCADE 4
+// minBLEP table size of the band-limited step output stage, the low-cost profile halves the length of every step
+#ifdef SCHLAPPI_LOW_COST
+#define NIBBLER_MINBLEP_ZERO_CROSSINGS 8
+#else
+#define NIBBLER_MINBLEP_ZERO_CROSSINGS 16
+#endif
+#define NIBBLER_MINBLEP_OVERSAMPLE 16
 
 
-struct UpsampledTrigger {
-    UpsampledTrigger() : upsampler(0.7f) {}
-    std::array<float, NIBBLER_UPSAMPLE_RATIO> input;
-    dsp::Upsampler<NIBBLER_UPSAMPLE_RATIO, NIBBLER_UPSAMPLE_QUALITY> upsampler;
-    dsp::SchmittTrigger trigger;
-
-    void process(float in) {
-        upsampler.process(in, input.data());
-    }
-};
-
 struct NibbleRegister {
-    unsigned char heldValue;
+    unsigned int heldValue;
     NibbleRegister() : heldValue(0) {}
-    unsigned char process(unsigned char input, bool shift, bool shiftData, bool clock, bool reset) {
+    // mask is 15 for one Nibbler and covers every nibble of a cascade
+    unsigned int process(unsigned int input, bool shift, bool shiftData, bool clock, bool reset, unsigned int mask = 15) {
         if (clock) {
-            heldValue = input & 15;
+            heldValue = input & mask;
             heldValue <<= shift ? 1 : 0;
             heldValue += shift && shiftData ? 1 : 0;
         }
@@ -35,6 +49,868 @@ struct NibbleRegister {
     }
 };
 
+// One Nibbler's register as a state machine over its switch settings. `sums` maps the held value, gates, carry in and
+// subtract gate of a channel to the summed input byte, `steps` maps that byte and the shift, shift data, clock and reset
+// states to the next held value, so a subsample is two lookups per channel. A held value takes up to 5 bits after a
+// shift, a summed byte up to 6. The tables only depend on the switches, so get() builds them for every setting once
+// and all engines share them.
+struct NibblerTransitionTable {
+    // bits of a channel's states in a lanes word, see spreadLanes()
+    static const int GATES = 0;
+    static const int CARRY_IN = NIBBLER_NUM_BITS;
+    static const int SUBTRACT = NIBBLER_NUM_BITS + 1;
+    static const int SHIFT = NIBBLER_NUM_BITS + 2;
+    static const int SHIFT_RISING = NIBBLER_NUM_BITS + 3;
+    static const int SHIFT_DATA = NIBBLER_NUM_BITS + 4;
+    static const int CLOCK_RISING = NIBBLER_NUM_BITS + 5;
+    static const int RESET = NIBBLER_NUM_BITS + 6;
+    static const int STATES = NIBBLER_NUM_BITS + 7;
+
+    // the held value goes below the gates, carry in and subtract in a `sums` index
+    static const int HELD_BITS = 5;
+    // the summed byte goes below the shift, shift data, clock and reset states in a `steps` index
+    static const int SUM_BITS = 6;
+    static const int SUM_STATES = (1 << SHIFT) - 1;
+    static const int STEP_STATES = ((1 << STATES) - 1) & ~SUM_STATES;
+    // a `steps` entry that leaves the held value as it is
+    static const unsigned char HOLD = 0x80;
+
+    static_assert(SHIFT == SUM_BITS, "the summed byte has to fill the bits below the shift state");
+
+    typedef std::array<unsigned char, 1 << (HELD_BITS + SHIFT)> Sums;
+    typedef std::array<unsigned char, 1 << STATES> Steps;
+
+    // by the add switches and the subtract switch, see sumsFor()
+    std::array<Sums, 32> sums;
+    // by the reset button and the async switch, see stepsFor()
+    std::array<Steps, 4> steps;
+
+    NibblerTransitionTable() {
+        for (auto k = 0; k < static_cast<int>(sums.size()); ++k) {
+            unsigned char add = k & 15;
+            bool subtractSwitch = (k >> 4) & 1;
+            for (auto i = 0; i < static_cast<int>(sums[k].size()); ++i) {
+                unsigned int held = i & ((1 << HELD_BITS) - 1);
+                unsigned int states = i >> HELD_BITS;
+                unsigned int inputByte = ((states >> GATES) & 15) + ((states >> CARRY_IN) & 1) + add;
+                if (subtractSwitch != (((states >> SUBTRACT) & 1) != 0)) {
+                    inputByte = 16 - (inputByte & 15);
+                }
+                sums[k][i] = inputByte + held;
+            }
+        }
+
+        for (auto k = 0; k < static_cast<int>(steps.size()); ++k) {
+            bool resetButtonDown = k & 1;
+            bool async = (k >> 1) & 1;
+            for (auto i = 0; i < static_cast<int>(steps[k].size()); ++i) {
+                auto bit = [i](int b) { return ((i >> b) & 1) != 0; };
+                bool clock = bit(CLOCK_RISING) || (async && bit(SHIFT_RISING));
+                bool reset = bit(RESET) || resetButtonDown;
+                NibbleRegister nibbleRegister;
+                steps[k][i] = clock || reset
+                              ? nibbleRegister.process(i & SUM_STATES, bit(SHIFT), bit(SHIFT_DATA), clock, reset)
+                              : HOLD;
+            }
+        }
+    }
+
+    /** Built by the first caller, engine constructors call it so that it never happens on the audio thread */
+    static const NibblerTransitionTable& get() {
+        static const NibblerTransitionTable table;
+        return table;
+    }
+
+    const Sums& sumsFor(unsigned char add, bool subtractSwitch) const {
+        return sums[add | (subtractSwitch << 4)];
+    }
+
+    const Steps& stepsFor(bool resetButtonDown, bool async) const {
+        return steps[resetButtonDown | (async << 1)];
+    }
+
+    // Moves bit c of a movemask bitfield to bit 16 * c, so that one word can hold the states of all four channels
+    static uint64_t spreadLanes(int mask) {
+        static const std::array<uint64_t, 16> lanes = []() {
+            std::array<uint64_t, 16> l;
+            for (auto m = 0; m < 16; ++m) {
+                l[m] = 0;
+                for (auto c = 0; c < 4; ++c) {
+                    l[m] |= static_cast<uint64_t>((m >> c) & 1) << (16 * c);
+                }
+            }
+            return l;
+        }();
+        return lanes[mask];
+    }
+};
+
+// gates, carry in, subtract, reset, clock, shift, shift data and data xor in; bits and carry, STEP, OFFSET STEP out
+#define NIBBLER_BLOCK_INPUTS (NIBBLER_NUM_BITS + 7)
+typedef FrameBlock<NIBBLER_BLOCK_INPUTS, NIBBLER_NUM_BITS + 3> NibblerBlock;
+
+// Input voltages for one group of four polyphony channels
+struct NibblerInputs {
+    std::array<float_4, NIBBLER_NUM_BITS> gates;
+    float_4 carryIn, subtract, reset, clock, shift, shiftData, shiftXor;
+
+    // the inputs in NibblerBlock order
+    std::array<float_4, NIBBLER_BLOCK_INPUTS> toFrame() const {
+        std::array<float_4, NIBBLER_BLOCK_INPUTS> frame;
+        std::copy(gates.begin(), gates.end(), frame.begin());
+        frame[NIBBLER_NUM_BITS + 0] = carryIn;
+        frame[NIBBLER_NUM_BITS + 1] = subtract;
+        frame[NIBBLER_NUM_BITS + 2] = reset;
+        frame[NIBBLER_NUM_BITS + 3] = clock;
+        frame[NIBBLER_NUM_BITS + 4] = shift;
+        frame[NIBBLER_NUM_BITS + 5] = shiftData;
+        frame[NIBBLER_NUM_BITS + 6] = shiftXor;
+        return frame;
+    }
+
+    static NibblerInputs fromBlock(const NibblerBlock& block, int f) {
+        NibblerInputs in;
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            in.gates[b] = block.inputs[b][f];
+        }
+        in.carryIn = block.inputs[NIBBLER_NUM_BITS + 0][f];
+        in.subtract = block.inputs[NIBBLER_NUM_BITS + 1][f];
+        in.reset = block.inputs[NIBBLER_NUM_BITS + 2][f];
+        in.clock = block.inputs[NIBBLER_NUM_BITS + 3][f];
+        in.shift = block.inputs[NIBBLER_NUM_BITS + 4][f];
+        in.shiftData = block.inputs[NIBBLER_NUM_BITS + 5][f];
+        in.shiftXor = block.inputs[NIBBLER_NUM_BITS + 6][f];
+        return in;
+    }
+};
+
+// Panel state shared by all channels
+struct NibblerControls {
+    unsigned char add;
+    unsigned char stepOffset;
+    bool subtractSwitch;
+    bool resetButtonDown;
+    bool async;
+    bool shiftDataConnected;
+
+    // packs the controls into one value, so that engines can tell when any of them moved
+    int key() const {
+        return add | (stepOffset << 4) | (subtractSwitch << 8) | (resetButtonDown << 9) | (async << 10)
+               | (shiftDataConnected << 11);
+    }
+};
+
+// Output voltages of one Nibbler for one group of four polyphony channels
+struct NibblerVoltages {
+    std::array<float_4, NIBBLER_NUM_BITS + 1> bitOut;
+    float_4 stepOut;
+    float_4 offsetStepOut;
+
+    NibblerVoltages() {
+        for (auto& b : bitOut) { b = 0.f; }
+        stepOut = 0.f; offsetStepOut = 0.f;
+    }
+
+    // in NibblerBlock output order
+    void getOutputs(std::array<float_4, NIBBLER_NUM_BITS + 3>& out) const {
+        std::copy(bitOut.begin(), bitOut.end(), out.begin());
+        out[NIBBLER_NUM_BITS + 1] = stepOut;
+        out[NIBBLER_NUM_BITS + 2] = offsetStepOut;
+    }
+
+    // where an output stage writes them, in NibblerBlock output order
+    std::array<float_4*, NIBBLER_NUM_BITS + 3> outputs() {
+        return {{&bitOut[0], &bitOut[1], &bitOut[2], &bitOut[3], &bitOut[4], &stepOut, &offsetStepOut}};
+    }
+};
+
+// Gates and switches of the Nibblers cascaded to the right of this one, follower k holds bits 4 * (k + 1) and up
+struct NibblerCascadeInputs {
+    int followers = 0;
+    std::array<std::array<float_4, NIBBLER_NUM_BITS>, NIBBLER_MAX_CASCADE - 1> gates;
+    std::array<unsigned char, NIBBLER_MAX_CASCADE - 1> add;
+    std::array<unsigned char, NIBBLER_MAX_CASCADE - 1> stepOffset;
+};
+
+// Accumulator for one group of four polyphony channels. The oversampled part lives in NibblerOversampledEngine so
+// that the ratio and filter quality can be chosen at runtime while the inner loops stay specialized. The decimated
+// outputs of the last process() call are in the NibblerVoltages base.
+struct NibblerEngine : NibblerVoltages {
+    // bit 8 of the most significant nibble as the register last read it, shift data follows it when unpatched
+    float_4 out8;
+
+    // Schmitt trigger states after the last subsample as movemask bitfields, for the lights
+    std::array<int, NIBBLER_NUM_BITS> gateState;
+    int carryInState, subtractState, clockState, shiftState, shiftDataState, shiftXorState;
+
+    // the expander bus feeding the unpatched gates, gate b takes stream b
+    BusInput bus;
+
+    // set by the module before every process() call, a cascade always runs frame by frame
+    NibblerCascadeInputs cascadeIn;
+
+    // set by the module when it builds the engine, oversampled engines then time input edges instead of upsampling
+    bool edgeTimedInputs = false;
+
+    NibblerEngine() {
+        out8 = 0.f;
+        for (auto& g : gateState) { g = 15; }
+        carryInState = subtractState = clockState = shiftState = shiftDataState = shiftXorState = 15;
+    }
+
+    virtual ~NibblerEngine() {}
+
+    // size of the whole engine, for the per-instance memory budget
+    virtual size_t stateBytes() = 0;
+
+    virtual void process(const NibblerInputs& in, const NibblerControls& controls) = 0;
+
+    // Builds the state of `followers` followers, called when the engine is built. Not for the audio thread.
+    virtual void buildCascade(int followers) = 0;
+
+    // Sets the number of followers, at most the number built. Their state is cleared when a cascade forms.
+    virtual void setCascade(int followers) = 0;
+
+    // outputs of follower k after the last process() call
+    virtual const NibblerVoltages& cascadeOutputs(int k) const = 0;
+
+    // Processes a full block in place. Engines without a block path run process() once per frame.
+    virtual void processBlock(NibblerBlock& block, int frames, const NibblerControls& controls) {
+        for (auto f = 0; f < frames; ++f) {
+            process(NibblerInputs::fromBlock(block, f), controls);
+            storeOutputs(block, f);
+        }
+    }
+
+    void storeOutputs(NibblerBlock& block, int f) const {
+        for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
+            block.outputs[b][f] = bitOut[b];
+        }
+        block.outputs[NIBBLER_NUM_BITS + 1][f] = stepOut;
+        block.outputs[NIBBLER_NUM_BITS + 2][f] = offsetStepOut;
+    }
+};
+
+// Accumulator output bytes of every subsample, per channel
+template <int RATIO>
+using NibblerBytes = std::array<std::array<unsigned char, RATIO>, 4>;
+
+// Subsamples of the bit, carry, STEP and OFFSET STEP outputs, in NibblerBlock output order
+typedef std::array<const float_4*, NIBBLER_NUM_BITS + 3> NibblerOutputSubsamples;
+
+// Where the engine renders them, see the output stages' render()
+typedef std::array<float_4*, NIBBLER_NUM_BITS + 3> NibblerSubsampleBuffers;
+
+// Decimates the output subsamples, the output stage of NibblerDecimatedEngine
+template <int RATIO, int QUALITY>
+struct NibblerDecimatedOutputs {
+    // decimator history
+    static const int SETTLE_FRAMES = QUALITY;
+
+    // the bit outputs are filtered a little lower than STEP and OFFSET STEP, so they need two kernels
+    PolyDecimatorBank<RATIO, QUALITY, NIBBLER_NUM_BITS + 1> bitOutDecimators{0.8f};
+    PolyDecimatorBank<RATIO, QUALITY, 2> stepDecimators{0.9f};
+
+    void reset() {
+        bitOutDecimators.reset();
+        stepDecimators.reset();
+    }
+
+    // Writes one frame of accumulator bytes to the output subsamples, starting at subsample `first`. The bytes rarely
+    // change within a frame, so a subsample whose bytes repeat the one before is copied.
+    void render(const NibblerBytes<RATIO>& bytes, unsigned char stepOffset, const NibblerSubsampleBuffers& out,
+                int first) {
+        for (auto s = 0; s < RATIO; ++s) {
+            if (s > 0 && bytes[0][s] == bytes[0][s - 1] && bytes[1][s] == bytes[1][s - 1]
+                && bytes[2][s] == bytes[2][s - 1] && bytes[3][s] == bytes[3][s - 1]) {
+                for (auto o = 0; o < NIBBLER_NUM_BITS + 3; ++o) {
+                    out[o][first + s] = out[o][first + s - 1];
+                }
+                continue;
+            }
+            for (auto c = 0; c < 4; ++c) {
+                auto outByte = bytes[c][s];
+                for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
+                    out[b][first + s][c] = (outByte & (1 << b)) ? 10.f : 0.f;
+                }
+                out[NIBBLER_NUM_BITS + 1][first + s][c] = static_cast<float>(outByte & 15) * NIBBLER_STEP_VOLTS;
+                out[NIBBLER_NUM_BITS + 2][first + s][c] =
+                        static_cast<float>((outByte + stepOffset) & 15) * NIBBLER_STEP_VOLTS;
+            }
+        }
+    }
+
+    void process(const NibblerOutputSubsamples& in, int frames, const NibblerSubsampleBuffers& out) {
+        bitOutDecimators.process({{in[0], in[1], in[2], in[3], in[4]}}, frames,
+                                 {{out[0], out[1], out[2], out[3], out[4]}});
+        stepDecimators.process({{in[NIBBLER_NUM_BITS + 1], in[NIBBLER_NUM_BITS + 2]}}, frames,
+                               {{out[NIBBLER_NUM_BITS + 1], out[NIBBLER_NUM_BITS + 2]}});
+    }
+};
+
+// Renders the accumulator bytes as band-limited steps, the output stage of NibblerMinBlepEngine. minBLEPs are only
+// inserted at the subsamples where the bytes change, so the cost follows the number of transitions. render() finishes
+// each frame as the engine hands it over and leaves it in the frame's first subsample, process() passes them on.
+template <int RATIO>
+struct NibblerMinBlepOutputs {
+    // bits and carry, STEP, OFFSET STEP
+    static const int NUM_OUTPUTS = NIBBLER_NUM_BITS + 3;
+    // until the minBLEP residue has been read out
+    static const int SETTLE_FRAMES = 2 * NIBBLER_MINBLEP_ZERO_CROSSINGS;
+
+    std::array<SharedMinBlepGenerator<NIBBLER_MINBLEP_ZERO_CROSSINGS, NIBBLER_MINBLEP_OVERSAMPLE, float_4>, NUM_OUTPUTS> minBleps;
+    // output voltages without the minBLEP residue, and the bytes and step offset they were set from
+    std::array<float_4, NUM_OUTPUTS> levels;
+    std::array<unsigned char, 4> levelBytes;
+    unsigned char levelStepOffset;
+
+    NibblerMinBlepOutputs() {
+        reset();
+    }
+
+    void reset() {
+        for (auto& minBlep : minBleps) { minBlep.reset(); }
+        for (auto& l : levels) { l = 0.f; }
+        levelBytes.fill(0);
+        levelStepOffset = 0;
+    }
+
+    void render(const NibblerBytes<RATIO>& bytes, unsigned char stepOffset, const NibblerSubsampleBuffers& out,
+                int first) {
+        for (auto s = 0; s < RATIO; ++s) {
+            if (bytes[0][s] == levelBytes[0] && bytes[1][s] == levelBytes[1] && bytes[2][s] == levelBytes[2]
+                && bytes[3][s] == levelBytes[3] && stepOffset == levelStepOffset) {
+                continue;
+            }
+            std::array<float_4, NUM_OUTPUTS> next;
+            for (auto c = 0; c < 4; ++c) {
+                auto outByte = levelBytes[c] = bytes[c][s];
+                for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
+                    next[b][c] = (outByte & (1 << b)) ? 10.f : 0.f;
+                }
+                next[NIBBLER_NUM_BITS + 1][c] = static_cast<float>(outByte & 15) * NIBBLER_STEP_VOLTS;
+                next[NIBBLER_NUM_BITS + 2][c] = static_cast<float>((outByte + stepOffset) & 15) * NIBBLER_STEP_VOLTS;
+            }
+            levelStepOffset = stepOffset;
+            for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+                float_4 changed = next[o] != levels[o];
+                if (simd::movemask(changed)) {
+                    minBleps[o].insertDiscontinuity(static_cast<float>(s + 1 - RATIO) / RATIO,
+                                                    simd::ifelse(changed, next[o] - levels[o], 0.f));
+                    levels[o] = next[o];
+                }
+            }
+        }
+        for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+            out[o][first] = levels[o] + minBleps[o].process();
+        }
+    }
+
+    void process(const NibblerOutputSubsamples& in, int frames, const NibblerSubsampleBuffers& out) {
+        for (auto f = 0; f < frames; ++f) {
+            for (auto o = 0; o < NUM_OUTPUTS; ++o) {
+                out[o][f] = in[o][f * RATIO];
+            }
+        }
+    }
+};
+
+// Trigger states of one chunk in NibblerOversampledEngine, shared by all engines on a thread. The upsampled inputs are
+// in the pipeline's buffers. A cascade's followers run frame by frame and share the last two, one follower at a time.
+struct NibblerChunkBuffers {
+    typedef std::array<int, BLOCK_CHUNK_MAX_SUBSAMPLES> States;
+    typedef std::array<float_4, OVERSAMPLING_MAX_RATIO> Subsamples;
+
+    std::array<States, NIBBLER_NUM_BITS> gateHigh;
+    States carryInHigh, subtractHigh, resetHigh, clockHigh, clockRising, shiftHigh, shiftRising, shiftDataHigh,
+            shiftXorHigh;
+    std::array<Subsamples, NIBBLER_NUM_BITS> followerGates;
+    std::array<Subsamples, NIBBLER_NUM_BITS + 3> followerOutputs;
+};
+
+// The nibble of one follower in a cascade. It only runs frame by frame, so every buffer holds one frame. Engines are
+// built with one per follower of the cascade they lead, see NibblerEngineConfig::followers.
+template <int RATIO, int QUALITY, typename TOutputs>
+struct NibblerFollower {
+    PolyUpsamplerBank<RATIO, QUALITY, NIBBLER_NUM_BITS> upsamplers{NIBBLER_UPSAMPLER_CUTOFF, false};
+    std::array<dsp::TSchmittTrigger<float_4>, NIBBLER_NUM_BITS> triggers;
+    std::array<std::array<int, RATIO>, NIBBLER_NUM_BITS> gateHigh;
+    // last frame's gate voltages, for edge-timed inputs
+    std::array<float_4, NIBBLER_NUM_BITS> previousGates;
+
+    NibblerBytes<RATIO> accumulatorOutBytes;
+    TOutputs outputStage;
+    NibblerVoltages voltages;
+
+    NibblerFollower() {
+        reset();
+    }
+
+    // back to the state of a new cascade, without allocating
+    void reset() {
+        upsamplers.reset();
+        for (auto& trigger : triggers) {
+            trigger.reset();
+        }
+        previousGates.fill(0.f);
+        for (auto& channel : accumulatorOutBytes) {
+            std::fill(channel.begin(), channel.end(), 0);
+        }
+        outputStage.reset();
+        voltages = NibblerVoltages();
+    }
+
+    // Upsamples and triggers, or edge-times, the gates for one frame. Edge-timed thresholds are scaled like the
+    // leader's, see NibblerOversampledEngine::edgeThresholdScale.
+    void processGates(const std::array<float_4, NIBBLER_NUM_BITS>& gates, bool edgeTimed, float edgeThresholdScale) {
+        if (edgeTimed) {
+            for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                unpackFrameStates<RATIO>(edgeTimedStates<RATIO>(triggers[b], previousGates[b], gates[b],
+                                                                0.1f * edgeThresholdScale, edgeThresholdScale),
+                                         gateHigh[b].data());
+            }
+            return;
+        }
+        auto& upsampledGates = chunkBuffers<NibblerChunkBuffers>().followerGates;
+        std::array<const float_4*, NIBBLER_NUM_BITS> gateIn;
+        std::array<float_4*, NIBBLER_NUM_BITS> gateOut;
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            gateIn[b] = &gates[b];
+            gateOut[b] = upsampledGates[b].data();
+        }
+        upsamplers.process(gateIn, 1, gateOut);
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            for (auto s = 0; s < RATIO; ++s) {
+                triggers[b].process(upsampledGates[b][s], 0.1f, 1.f);
+                gateHigh[b][s] = simd::movemask(triggers[b].isHigh());
+            }
+        }
+    }
+};
+
+// Trigger states are kept as movemask bitfields per subsample (bit n is channel n of the group), the register itself
+// runs per channel. The engine is the kernel of an OversampledPipeline over its inputs in NibblerBlock order. TOutputs
+// is the pipeline's output stage. The engine hands it each frame's accumulator bytes to render into the subsamples of
+// the bit, STEP and OFFSET STEP outputs, which it then turns into frames.
+//
+// An unpatched shift data input follows the bit 8 output, so the register has to see each frame's output before it
+// runs the next one. While it is unpatched the pipeline goes frame by frame and the register reads the decimated bit 8
+// voltage, the upsampled shift data input goes unused. Otherwise block processing runs chunks of BLOCK_CHUNK_FRAMES.
+// Per-sample processing is a chunk of one frame.
+template <int RATIO, int QUALITY, typename TOutputs>
+struct NibblerOversampledEngine : NibblerEngine {
+    typedef OversampledPipeline<RATIO, QUALITY, NIBBLER_BLOCK_INPUTS, NIBBLER_NUM_BITS + 3, TOutputs> Pipeline;
+
+    // the trigger thresholds are set against the gain of the unnormalized kernel
+    Pipeline pipeline{NIBBLER_UPSAMPLER_CUTOFF, false};
+    // Edge-timed inputs compare the input voltages, so their thresholds are divided by the upsampler gain to switch
+    // where the upsampled inputs would
+    const float edgeThresholdScale = 1.f / SharedResamplerKernel<RATIO, QUALITY>::gain(NIBBLER_UPSAMPLER_CUTOFF);
+
+    // in NibblerBlock order
+    std::array<dsp::TSchmittTrigger<float_4>, NIBBLER_BLOCK_INPUTS> triggers;
+    // last frame's input voltages in NibblerBlock order, for edge-timed inputs
+    std::array<float_4, NIBBLER_BLOCK_INPUTS> previousInputs;
+
+    std::array<NibbleRegister, 4> nibbleRegisters;
+    // runs the register while there is no cascade, shared by all engines
+    const NibblerTransitionTable* transitions = &NibblerTransitionTable::get();
+
+    NibblerBytes<RATIO> accumulatorOutBytes;
+
+    // the followers' state, built only for engines that lead a cascade and only run while there are followers
+    std::array<std::unique_ptr<NibblerFollower<RATIO, QUALITY, TOutputs>>, NIBBLER_MAX_CASCADE - 1> cascade;
+    // followers in the last frame the register ran, the last of them holds bit 8
+    int lastFollowers = 0;
+
+    // panel state of the frames being processed, a change restarts the static input check
+    NibblerControls activeControls{};
+    int previousControls = -1;
+
+    size_t stateBytes() override {
+        size_t bytes = sizeof(*this);
+        for (auto& follower : cascade) {
+            bytes += follower ? sizeof(*follower) : 0;
+        }
+        return bytes;
+    }
+
+    void buildCascade(int followers) override {
+        for (auto k = 0; k < followers; ++k) {
+            cascade[k].reset(new NibblerFollower<RATIO, QUALITY, TOutputs>);
+        }
+    }
+
+    void setCascade(int followers) override {
+        if (followers > 0 && cascadeIn.followers == 0) {
+            for (auto k = 0; k < followers; ++k) {
+                cascade[k]->reset();
+            }
+        }
+        cascadeIn.followers = followers;
+    }
+
+    const NibblerVoltages& cascadeOutputs(int k) const override {
+        return cascade[k]->voltages;
+    }
+
+    NibblerOversampledEngine() {
+        for (auto& bytes : accumulatorOutBytes) {
+            std::fill(bytes.begin(), bytes.end(), 0);
+        }
+        for (auto& v : previousInputs) { v = 0.f; }
+
+        // upsampler history, one sample each for the triggers and the register, then the output stage
+        pipeline.staticInputs.settleFrames = QUALITY + 2 + TOutputs::SETTLE_FRAMES;
+    }
+
+    void setControls(const NibblerControls& controls) {
+        activeControls = controls;
+        if (controls.key() != previousControls) {
+            previousControls = controls.key();
+            pipeline.staticInputs.reset();
+        }
+    }
+
+    // the decimated bit 8 output after the last frame the register ran
+    float_4 bit8() const {
+        return lastFollowers > 0 ? cascade[lastFollowers - 1]->voltages.bitOut[3] : bitOut[3];
+    }
+
+    void process(const NibblerInputs& in, const NibblerControls& controls) override {
+        setControls(controls);
+        // the followers' gates and switches are not part of the check, a cascade always runs
+        if (cascadeIn.followers > 0) {
+            pipeline.staticInputs.reset();
+        }
+        pipeline.process(in.toFrame(), *this, outputs());
+    }
+
+    void processBlock(NibblerBlock& block, int frames, const NibblerControls& controls) override {
+        setControls(controls);
+        pipeline.processBlock(block, frames, *this, outputs());
+    }
+
+    bool upsampleInputs() const {
+        return !edgeTimedInputs;
+    }
+
+    void staticCheck(typename Pipeline::Frame& check) const {
+        // bit 8 stands in for unpatched shift data, it can not move while nothing is processed
+        if (!activeControls.shiftDataConnected) {
+            check[NIBBLER_NUM_BITS + 5] = bit8();
+        }
+        // a bus-fed gate can change within a frame while its voltage does not
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            if (bus.uses(b)) {
+                check[b] = busCheckValue(bus.group->states[b]);
+            }
+        }
+    }
+
+    int chunkFrames() const {
+        return activeControls.shiftDataConnected ? BLOCK_CHUNK_FRAMES : 1;
+    }
+
+    // Triggers the inputs, runs the register of this Nibbler and its followers frame by frame and has the output stages
+    // render each frame. The followers' output stages also run here, the pipeline's only takes this Nibbler's outputs.
+    void processSubsamples(const typename Pipeline::Inputs& in, int frames,
+                           const std::array<float_4*, NIBBLER_BLOCK_INPUTS>& upsampled,
+                           const typename Pipeline::Outputs& out) {
+        const auto& controls = activeControls;
+        auto& buffers = chunkBuffers<NibblerChunkBuffers>();
+        auto& gateHigh = buffers.gateHigh;
+        auto& carryInHigh = buffers.carryInHigh;
+        auto& subtractHigh = buffers.subtractHigh;
+        auto& resetHigh = buffers.resetHigh;
+        auto& clockHigh = buffers.clockHigh;
+        auto& clockRising = buffers.clockRising;
+        auto& shiftHigh = buffers.shiftHigh;
+        auto& shiftRising = buffers.shiftRising;
+        auto& shiftDataHigh = buffers.shiftDataHigh;
+        auto& shiftXorHigh = buffers.shiftXorHigh;
+
+        // the bus is only set for single frames
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            if (bus.uses(b)) {
+                unpackBusStates<RATIO>(bus.group->states[b], bus.ratio, upsampled[b]);
+            }
+        }
+
+        const int subsamples = frames * RATIO;
+        if (edgeTimedInputs) {
+            for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                if (bus.uses(b)) {
+                    trigger(triggers[b], upsampled[b], subsamples, 0.1f, 1.f, gateHigh[b].data());
+                    previousInputs[b] = in[b][frames - 1];
+                } else {
+                    edgeTrigger(b, in[b], frames, 0.1f, 1.f, gateHigh[b].data());
+                }
+            }
+            edgeTrigger(NIBBLER_NUM_BITS + 0, in[NIBBLER_NUM_BITS + 0], frames, 0.1f, 1.f, carryInHigh.data());
+            edgeTrigger(NIBBLER_NUM_BITS + 1, in[NIBBLER_NUM_BITS + 1], frames, 0.1f, 1.f, subtractHigh.data());
+            edgeTrigger(NIBBLER_NUM_BITS + 2, in[NIBBLER_NUM_BITS + 2], frames, 0.1f, 1.f, resetHigh.data());
+            edgeTrigger(NIBBLER_NUM_BITS + 3, in[NIBBLER_NUM_BITS + 3], frames, 0.1f, 1.f, clockHigh.data(),
+                        clockRising.data());
+            edgeTrigger(NIBBLER_NUM_BITS + 4, in[NIBBLER_NUM_BITS + 4], frames, 0.1f, 1.f, shiftHigh.data(),
+                        shiftRising.data());
+            if (controls.shiftDataConnected) {
+                edgeTrigger(NIBBLER_NUM_BITS + 5, in[NIBBLER_NUM_BITS + 5], frames, 0.f, 1.f, shiftDataHigh.data());
+            }
+            edgeTrigger(NIBBLER_NUM_BITS + 6, in[NIBBLER_NUM_BITS + 6], frames, 0.f, 1.f, shiftXorHigh.data());
+        } else {
+            for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                trigger(triggers[b], upsampled[b], subsamples, 0.1f, 1.f, gateHigh[b].data());
+            }
+            trigger(triggers[NIBBLER_NUM_BITS + 0], upsampled[NIBBLER_NUM_BITS + 0], subsamples, 0.1f, 1.f,
+                    carryInHigh.data());
+            trigger(triggers[NIBBLER_NUM_BITS + 1], upsampled[NIBBLER_NUM_BITS + 1], subsamples, 0.1f, 1.f,
+                    subtractHigh.data());
+            trigger(triggers[NIBBLER_NUM_BITS + 2], upsampled[NIBBLER_NUM_BITS + 2], subsamples, 0.1f, 1.f,
+                    resetHigh.data());
+            trigger(triggers[NIBBLER_NUM_BITS + 3], upsampled[NIBBLER_NUM_BITS + 3], subsamples, 0.1f, 1.f,
+                    clockHigh.data(), clockRising.data());
+            trigger(triggers[NIBBLER_NUM_BITS + 4], upsampled[NIBBLER_NUM_BITS + 4], subsamples, 0.1f, 1.f,
+                    shiftHigh.data(), shiftRising.data());
+            if (controls.shiftDataConnected) {
+                trigger(triggers[NIBBLER_NUM_BITS + 5], upsampled[NIBBLER_NUM_BITS + 5], subsamples, 0.f, 1.f,
+                        shiftDataHigh.data());
+            }
+            trigger(triggers[NIBBLER_NUM_BITS + 6], upsampled[NIBBLER_NUM_BITS + 6], subsamples, 0.f, 1.f,
+                    shiftXorHigh.data());
+        }
+
+        // a cascade is one register over the nibbles of all its Nibblers, this one holds the lowest. The carry runs
+        // through the whole word within each subsample and only the word's carry comes out at CARRY.
+        const int followers = cascadeIn.followers;
+        for (auto k = 0; k < followers; ++k) {
+            cascade[k]->processGates(cascadeIn.gates[k], edgeTimedInputs, edgeThresholdScale);
+        }
+        const int width = NIBBLER_NUM_BITS * (followers + 1);
+        const unsigned int mask = (1u << width) - 1;
+        const unsigned int carryBit = 1u << width;
+        unsigned int add = controls.add;
+        for (auto k = 0; k < followers; ++k) {
+            add |= cascadeIn.add[k] << (NIBBLER_NUM_BITS * (k + 1));
+        }
+
+        for (auto f = 0; f < frames; ++f) {
+            auto first = f * RATIO;
+            // unpatched shift data follows bit 8, a chunk is one frame then, so the last one's output stage has run
+            if (!controls.shiftDataConnected) {
+                out8 = bit8();
+            }
+
+            if (followers == 0) {
+                runTransitions(first, controls);
+            } else {
+                for (auto c = 0; c < 4; ++c) {
+                    auto& nibbleRegister = nibbleRegisters[c];
+                    auto lane = [c](int mask) { return ((mask >> c) & 1) != 0; };
+
+                    for (auto s = 0; s < RATIO; ++s) {
+                        auto ss = first + s;
+                        unsigned int inputByte = 0;
+                        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                            inputByte += (lane(gateHigh[b][ss]) ? 1 : 0) << b;
+                        }
+                        for (auto k = 0; k < followers; ++k) {
+                            for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                                inputByte += (lane(cascade[k]->gateHigh[b][s]) ? 1u : 0u)
+                                             << (NIBBLER_NUM_BITS * (k + 1) + b);
+                            }
+                        }
+                        inputByte += lane(carryInHigh[ss]) ? 1 : 0;
+                        inputByte += add;
+                        if (controls.subtractSwitch != lane(subtractHigh[ss])) {
+                            inputByte = carryBit - (inputByte & mask);
+                        }
+                        inputByte += nibbleRegister.heldValue;
+
+                        auto hiShift = lane(shiftRising[ss]);
+                        auto hiClock = lane(clockRising[ss]);
+
+                        hiClock = controls.async ? (hiClock || hiShift) : hiClock;
+
+                        // when the shift data jack is unpatched, the bit 8 output voltage is used instead
+                        float s1 = controls.shiftDataConnected ? (lane(shiftDataHigh[ss]) ? 1.f : 0.f) : out8[c];
+                        auto s2 = lane(shiftXorHigh[ss]);
+
+                        auto shiftDataInput = (s1 != s2);
+
+                        nibbleRegister.process(inputByte,
+                                               lane(shiftHigh[ss]),
+                                               shiftDataInput,
+                                               hiClock,
+                                               (lane(resetHigh[ss]) || controls.resetButtonDown),
+                                               mask);
+                        // carry always comes from the summed input bytes, it is not held in the register
+                        auto outWord = controls.async ? inputByte : nibbleRegister.heldValue | (inputByte & carryBit);
+                        unsigned char carry = (outWord & carryBit) ? 16 : 0;
+                        accumulatorOutBytes[c][s] = (outWord & 15) | carry;
+                        for (auto k = 0; k < followers; ++k) {
+                            cascade[k]->accumulatorOutBytes[c][s] =
+                                    ((outWord >> (NIBBLER_NUM_BITS * (k + 1))) & 15) | carry;
+                        }
+                    }
+                }
+            }
+
+            pipeline.outputStage.render(accumulatorOutBytes, controls.stepOffset, out, first);
+            NibblerSubsampleBuffers followerOut;
+            NibblerOutputSubsamples followerIn;
+            for (auto o = 0; o < NIBBLER_NUM_BITS + 3; ++o) {
+                followerOut[o] = buffers.followerOutputs[o].data();
+                followerIn[o] = buffers.followerOutputs[o].data();
+            }
+            for (auto k = 0; k < followers; ++k) {
+                auto& follower = *cascade[k];
+                follower.outputStage.render(follower.accumulatorOutBytes, cascadeIn.stepOffset[k], followerOut, 0);
+                follower.outputStage.process(followerIn, 1, follower.voltages.outputs());
+            }
+            lastFollowers = followers;
+        }
+
+        auto last = frames * RATIO - 1;
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            gateState[b] = gateHigh[b][last];
+        }
+        carryInState = carryInHigh[last];
+        subtractState = subtractHigh[last];
+        clockState = clockHigh[last];
+        shiftState = shiftHigh[last];
+        // unpatched shift data has no trigger states, the light follows bit 8
+        if (controls.shiftDataConnected) {
+            shiftDataState = shiftDataHigh[last];
+        }
+        shiftXorState = shiftXorHigh[last];
+    }
+
+    // Runs the register of one frame from subsample `first` of the chunk through the transition table. The trigger
+    // states of all four channels are spread into one word per subsample, so each channel's table index is a shift and
+    // a mask.
+    void runTransitions(int first, const NibblerControls& controls) {
+        typedef NibblerTransitionTable T;
+        auto& buffers = chunkBuffers<NibblerChunkBuffers>();
+        auto& sums = transitions->sumsFor(controls.add, controls.subtractSwitch);
+        auto& steps = transitions->stepsFor(controls.resetButtonDown, controls.async);
+
+        // when the shift data jack is unpatched, the bit 8 output voltage is used instead, one per frame
+        const int dataWhenXorLow = simd::movemask(out8 != 0.f);
+        const int dataWhenXorHigh = simd::movemask(out8 != 1.f);
+
+        std::array<unsigned int, 4> held;
+        for (auto c = 0; c < 4; ++c) {
+            held[c] = nibbleRegisters[c].heldValue;
+        }
+
+        for (auto s = 0; s < RATIO; ++s) {
+            auto ss = first + s;
+            int shiftXor = buffers.shiftXorHigh[ss];
+            int shiftData = controls.shiftDataConnected
+                            ? buffers.shiftDataHigh[ss] ^ shiftXor
+                            : (shiftXor & dataWhenXorHigh) | (~shiftXor & dataWhenXorLow);
+
+            uint64_t lanes = 0;
+            for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                lanes |= T::spreadLanes(buffers.gateHigh[b][ss]) << (T::GATES + b);
+            }
+            lanes |= T::spreadLanes(buffers.carryInHigh[ss]) << T::CARRY_IN;
+            lanes |= T::spreadLanes(buffers.subtractHigh[ss]) << T::SUBTRACT;
+            lanes |= T::spreadLanes(buffers.shiftHigh[ss]) << T::SHIFT;
+            lanes |= T::spreadLanes(buffers.shiftRising[ss]) << T::SHIFT_RISING;
+            lanes |= T::spreadLanes(shiftData & 15) << T::SHIFT_DATA;
+            lanes |= T::spreadLanes(buffers.clockRising[ss]) << T::CLOCK_RISING;
+            lanes |= T::spreadLanes(buffers.resetHigh[ss]) << T::RESET;
+
+            for (auto c = 0; c < 4; ++c) {
+                auto states = static_cast<unsigned int>(lanes >> (16 * c));
+                unsigned int inputByte = sums[held[c] | ((states & T::SUM_STATES) << T::HELD_BITS)];
+                unsigned char next = steps[(states & T::STEP_STATES) | inputByte];
+                held[c] = next == T::HOLD ? held[c] : next;
+                // carry always comes from the summed input byte, it is not held in the register
+                auto outWord = controls.async ? inputByte : held[c] | (inputByte & 16);
+                accumulatorOutBytes[c][s] = outWord & 31;
+            }
+        }
+
+        for (auto c = 0; c < 4; ++c) {
+            nibbleRegisters[c].heldValue = held[c];
+        }
+    }
+
+    // Times the edges of input i, in NibblerBlock order, over `frames` frames at the engine rate, returning the high
+    // state and optionally the rising edges per subsample. The thresholds are those of the upsampled inputs.
+    void edgeTrigger(int i, const float_4* voltages, int frames, float offThreshold, float onThreshold, int* high,
+                     int* rising = nullptr) {
+        offThreshold *= edgeThresholdScale;
+        onThreshold *= edgeThresholdScale;
+        for (auto f = 0; f < frames; ++f) {
+            int before = simd::movemask(triggers[i].isHigh());
+            SubsampleMask states = edgeTimedStates<RATIO>(triggers[i], previousInputs[i], voltages[f], offThreshold,
+                                                          onThreshold);
+            unpackFrameStates<RATIO>(states, high + f * RATIO);
+            if (rising) {
+                unpackFrameStates<RATIO>(risingStates(states, before), rising + f * RATIO);
+            }
+        }
+    }
+
+    // Runs the upsampled input through its Schmitt trigger, returning the high state per subsample
+    static void trigger(dsp::TSchmittTrigger<float_4>& t, const float_4* upsampled, int subsamples,
+                        float offThreshold, float onThreshold, int* high) {
+        for (auto s = 0; s < subsamples; ++s) {
+            t.process(upsampled[s], offThreshold, onThreshold);
+            high[s] = simd::movemask(t.isHigh());
+        }
+    }
+
+    // Same as above, but also returns the rising edges per subsample
+    static void trigger(dsp::TSchmittTrigger<float_4>& t, const float_4* upsampled, int subsamples,
+                        float offThreshold, float onThreshold, int* high, int* rising) {
+        for (auto s = 0; s < subsamples; ++s) {
+            rising[s] = simd::movemask(t.process(upsampled[s], offThreshold, onThreshold));
+            high[s] = simd::movemask(t.isHigh());
+        }
+    }
+};
+
+// What the leader of a cascade sends each follower, the follower's outputs for the next frame
+struct NibblerCascadeMessage {
+    int channels = 0;
+    std::array<std::array<float_4, NIBBLER_NUM_BITS + 3>, PORT_MAX_CHANNELS / 4> outputs;
+
+    NibblerCascadeMessage() {
+        for (auto& group : outputs) {
+            std::fill(group.begin(), group.end(), float_4(0.f));
+        }
+    }
+};
+
+template <int RATIO, int QUALITY>
+using NibblerDecimatedEngine = NibblerOversampledEngine<RATIO, QUALITY, NibblerDecimatedOutputs<RATIO, QUALITY>>;
+
+template <int RATIO, int QUALITY>
+using NibblerMinBlepEngine = NibblerOversampledEngine<RATIO, QUALITY, NibblerMinBlepOutputs<RATIO>>;
+
+// The settings Nibbler engines are built for, changing any of them takes new engines
+struct NibblerEngineConfig {
+    int engineType = 0;
+    int ratio = 0;
+    int quality = 0;
+    bool edgeTimed = false;
+    int blockSize = 0;
+    // followers of the cascade this Nibbler leads, the engines hold their state
+    int followers = 0;
+
+    bool operator==(const NibblerEngineConfig& other) const {
+        return engineType == other.engineType && ratio == other.ratio && quality == other.quality &&
+               edgeTimed == other.edgeTimed && blockSize == other.blockSize && followers == other.followers;
+    }
+};
+
+typedef EngineSet<NibblerEngine, NibblerBlock, NibblerEngineConfig> NibblerEngineSet;
+
 struct Nibbler : Module {
 	enum ParamId {
 		ADD_8_PARAM,
@@ -94,28 +970,40 @@ struct Nibbler : Module {
 		LIGHTS_LEN
 	};
 
-    std::array<dsp::Decimator<NIBBLER_UPSAMPLE_RATIO, NIBBLER_UPSAMPLE_QUALITY>, NIBBLER_NUM_BITS + 1> bitOutDecimators;
-
-    std::array<unsigned char, NIBBLER_UPSAMPLE_RATIO> inputBytes;
-
-    std::array<UpsampledTrigger, NIBBLER_UPSAMPLE_RATIO> gateUTrig;
-
-    std::array<std::array<float, NIBBLER_UPSAMPLE_RATIO>, NIBBLER_NUM_BITS + 1> upsampledBitOutput;
-
-    UpsampledTrigger carryInUTrig;
-    UpsampledTrigger subtractUTrig;
-    UpsampledTrigger resetUTrig;
-    UpsampledTrigger clockUTrig;
-    UpsampledTrigger shiftUTrig;
-    UpsampledTrigger shiftDataUTrig;
-    UpsampledTrigger shiftXorUTrig;
-
-    std::array<unsigned char, NIBBLER_UPSAMPLE_RATIO> accumulatorOutBytes;
+    enum EngineType {
+        OVERSAMPLED_ENGINE,
+        MINBLEP_ENGINE
+    };
 
-    dsp::Decimator<NIBBLER_UPSAMPLE_RATIO, NIBBLER_UPSAMPLE_QUALITY> stepDecimator;
-    dsp::Decimator<NIBBLER_UPSAMPLE_RATIO, NIBBLER_UPSAMPLE_QUALITY> offsetStepDecimator;
-    std::array<float, NIBBLER_UPSAMPLE_RATIO> stepDecimatorInput;
-    std::array<float, NIBBLER_UPSAMPLE_RATIO> offsetStepDecimatorInput;
+    OversamplingSettings oversampling{NIBBLER_UPSAMPLE_QUALITY};
+    GateInputSettings gateInputs;
+    BlockSettings blockProcessing;
+    BitHistorySettings bitHistorySettings;
+
+    // lights and the bit history run at control rate
+    dsp::ClockDivider lightDivider;
+    BitHistory bitHistory;
+
+#ifdef SCHLAPPI_PROFILE
+    ModuleProfile profile;
+#endif
+    // the oversampled engine stays the default in the low-cost profile, at the lower ratio it beats the minBLEP stage
+    static const int DEFAULT_ENGINE = OVERSAMPLED_ENGINE;
+    int engineType = DEFAULT_ENGINE;
+    float sampleRate = OVERSAMPLING_REFERENCE_RATE;
+
+    // one engine per group of four polyphony channels and the frame blocks of block mode
+    EngineHandoff<NibblerEngineSet> engineSets;
+
+    // Adjacent Nibblers with this set extend the one on their left by four bits. The leftmost one leads: it reads the
+    // gates and switches of its followers, runs the whole register and sends each follower its outputs through that
+    // follower's left expander. Rack writes inputs between frames, so reading them from another module is safe.
+    bool cascade = false;
+    std::array<NibblerCascadeMessage, 2> cascadeMessages;
+    // the leader holds its own outputs back one frame, so that the whole word changes together
+    std::array<std::array<float_4, NIBBLER_NUM_BITS + 3>, PORT_MAX_CHANNELS / 4> cascadeDelay;
+    // normals unpatched gates to the bits of a BTFLD or BTMX on the left, off unless set in the menu
+    bool busInputs = false;
 
     const std::array<InputId, NIBBLER_NUM_BITS> gateInputIds {
         GATE_1_INPUT, GATE_2_INPUT, GATE_4_INPUT, GATE_8_INPUT
@@ -133,11 +1021,6 @@ struct Nibbler : Module {
         OUT_1_LIGHT, OUT_2_LIGHT, OUT_4_LIGHT, OUT_8_LIGHT, CARRY_LIGHT
     };
 
-    float out8;
-    float gateVoltage;
-
-    NibbleRegister nibbleRegister;
-
 	Nibbler() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 		configParam(ADD_8_PARAM, 0.f, 1.f, 0.f, "Add 8");
@@ -168,166 +1051,345 @@ struct Nibbler : Module {
 		configOutput(OUT_2_OUTPUT, "Bit 2");
 		configOutput(OUT_1_OUTPUT, "Bit 1");
 
-        out8 = 0;
+        leftExpander.producerMessage = &cascadeMessages[0];
+        leftExpander.consumerMessage = &cascadeMessages[1];
+        for (auto& group : cascadeDelay) {
+            std::fill(group.begin(), group.end(), float_4(0.f));
+        }
+        lightDivider.setDivision(TELEMETRY_DIVISION);
+        updateEngines();
+    }
 
-        // std::fill(gateUpsamplers.begin(), gateUpsamplers.end(), 0.4f);
-        std::fill(bitOutDecimators.begin(), bitOutDecimators.end(), 0.8f);
-        std::fill(accumulatorOutBytes.begin(), accumulatorOutBytes.end(), 0);
+    // Builds new engines when the engine type, the gate inputs, block processing, the followers this Nibbler leads or
+    // the ratio and quality the oversampling settings ask for at this sample rate change. Called where those change
+    // and by the widget as cascades form, never from process(), which switches to the new engines through engineSets.
+    void updateEngines() {
+        NibblerEngineConfig config;
+        config.engineType = engineType;
+        config.ratio = oversampling.resolveRatio(sampleRate, NIBBLER_UPSAMPLE_RATIO);
+        config.quality = oversampling.quality;
+        config.edgeTimed = gateInputs.edgeTimed;
+        config.blockSize = blockProcessing.size;
+        std::array<Nibbler*, NIBBLER_MAX_CASCADE - 1> followers;
+        config.followers = getCascadeFollowers(followers);
+        engineSets.update(config, [](const NibblerEngineConfig& config) {
+            auto set = new NibblerEngineSet(config);
+            for (auto& engine : set->engines) {
+                if (config.engineType == MINBLEP_ENGINE) {
+                    engine.reset(createOversampledEngine<NibblerEngine, NibblerMinBlepEngine>(config.ratio,
+                                                                                              config.quality));
+                } else {
+                    engine.reset(createOversampledEngine<NibblerEngine, NibblerDecimatedEngine>(config.ratio,
+                                                                                                config.quality));
+                }
+                engine->edgeTimedInputs = config.edgeTimed;
+                engine->buildCascade(config.followers);
+            }
+            return set;
+        });
+    }
 
-        // the convolution kernel in the vcvrack upsampler/decimator does not sum to 1, so we have to compensate that
-        // when generating upsampled pulses, so that they will downsample to 10 volts.
-        float kernelSum = 0;
-        for (auto i = 0; i < NIBBLER_UPSAMPLE_RATIO * NIBBLER_UPSAMPLE_QUALITY; ++i) {
-            kernelSum += bitOutDecimators[0].kernel[i];
-        }
-        gateVoltage = 10.f / kernelSum;
+    // Memory held by this instance: the module, its engines and the frame blocks of block mode. The chunk buffers are
+    // shared per thread and not counted.
+    size_t stateBytes() {
+        return sizeof(*this) + engineSets.current->stateBytes();
     }
 
-    void computeInputBytes(const ProcessArgs& args) {
-        for (auto& b : inputBytes) { b = 0; }
+    void onSampleRateChange(const SampleRateChangeEvent& e) override {
+        sampleRate = e.sampleRate;
+        updateEngines();
+    }
 
-        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
-            gateUTrig[b].process(inputs[gateInputIds[b]].getVoltage());
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        oversampling.toJson(rootJ);
+        gateInputs.toJson(rootJ);
+        blockProcessing.toJson(rootJ);
+        bitHistorySettings.toJson(rootJ);
+        json_object_set_new(rootJ, "engine", json_integer(engineType));
+        json_object_set_new(rootJ, "cascade", json_boolean(cascade));
+        json_object_set_new(rootJ, "busInputs", json_boolean(busInputs));
+        return rootJ;
+    }
 
-            for (auto s = 0; s < NIBBLER_UPSAMPLE_RATIO; ++s) {
-                gateUTrig[b].trigger.process(gateUTrig[b].input[s], 0.1f, 1.0f);
-                inputBytes[s] += (gateUTrig[b].trigger.isHigh() ? 1 : 0) << b;
-            }
+    void dataFromJson(json_t* rootJ) override {
+        oversampling.fromJson(rootJ);
+        gateInputs.fromJson(rootJ);
+        blockProcessing.fromJson(rootJ);
+        bitHistorySettings.fromJson(rootJ);
+        json_t* engineJ = json_object_get(rootJ, "engine");
+        if (engineJ) {
+            engineType = json_integer_value(engineJ) == MINBLEP_ENGINE ? MINBLEP_ENGINE : OVERSAMPLED_ENGINE;
+        }
+        json_t* cascadeJ = json_object_get(rootJ, "cascade");
+        if (cascadeJ) {
+            cascade = json_boolean_value(cascadeJ);
+        }
+        json_t* busInputsJ = json_object_get(rootJ, "busInputs");
+        if (busInputsJ) {
+            busInputs = json_boolean_value(busInputsJ);
+        }
+        updateEngines();
+    }
 
-            lights[gateLightIds[b]].setBrightnessSmooth(gateUTrig[b].trigger.isHigh(), args.sampleTime);
+    // 0 for the leader of a cascade, k for its k-th follower. A Nibbler past the longest cascade leads a new one.
+    int getCascadePosition() {
+        int position = 0;
+        Nibbler* nibbler = this;
+        while (nibbler->cascade && nibbler->leftExpander.module && nibbler->leftExpander.module->model == modelNibbler) {
+            nibbler = static_cast<Nibbler*>(nibbler->leftExpander.module);
+            ++position;
         }
+        return position % NIBBLER_MAX_CASCADE;
+    }
 
-        carryInUTrig.process(inputs[CARRY_IN_INPUT].getVoltage());
+    bool isCascadeFollower() {
+        return getCascadePosition() > 0;
+    }
 
-        for (auto s = 0; s < NIBBLER_UPSAMPLE_RATIO; ++s) {
-            carryInUTrig.trigger.process(carryInUTrig.input[s], 0.1f, 1.0f);
-            inputBytes[s] += carryInUTrig.trigger.isHigh() ? 1 : 0;
+    // the followers of this Nibbler from left to right, none unless it leads a cascade
+    int getCascadeFollowers(std::array<Nibbler*, NIBBLER_MAX_CASCADE - 1>& followers) {
+        int n = 0;
+        if (isCascadeFollower()) {
+            return n;
         }
+        Module* right = rightExpander.module;
+        while (n < NIBBLER_MAX_CASCADE - 1 && right && right->model == modelNibbler) {
+            auto follower = static_cast<Nibbler*>(right);
+            if (!follower->cascade) {
+                break;
+            }
+            followers[n++] = follower;
+            right = follower->rightExpander.module;
+        }
+        return n;
+    }
 
-        lights[CARRY_IN_LIGHT].setBrightnessSmooth(carryInUTrig.trigger.isHigh(), args.sampleTime);
-
+    unsigned char getAdd() {
         unsigned char add = 0;
-
         add += (params[ADD_1_PARAM].getValue() > 0.5f) ? 1 : 0;
         add += (params[ADD_2_PARAM].getValue() > 0.5f) ? 2 : 0;
         add += (params[ADD_4_PARAM].getValue() > 0.5f) ? 4 : 0;
         add += (params[ADD_8_PARAM].getValue() > 0.5f) ? 8 : 0;
+        return add;
+    }
 
-        for (auto& s : inputBytes) {
-            s += add;
-        }
+    unsigned char getStepOffset() {
+        auto s1 = params[OFFSET_1_PARAM].getValue() > 0.5f;
+        auto s2 = params[OFFSET_2_PARAM].getValue() > 0.5f;
 
-        subtractUTrig.process(inputs[SUB_INPUT].getVoltage());
-        bool subtractSwitch = (params[SUBTRACT_ADD_PARAM].getValue() > 0.5f);
-        for (auto s = 0; s < NIBBLER_UPSAMPLE_RATIO; ++s) {
-            subtractUTrig.trigger.process(subtractUTrig.input[s], 0.1, 1.f);
-            if (subtractSwitch != (subtractUTrig.trigger.isHigh())) {
-                inputBytes[s] = 16 - (inputBytes[s] & 15);
-            }
+        if (s1 && !s2) {
+            return 4;
+        } else if (!s1 && s2) {
+            return 2;
+        } else if (s1 && s2) {
+            return 8;
         }
-
-        lights[SUB_LIGHT].setBrightnessSmooth((subtractSwitch != subtractUTrig.trigger.isHigh()) ? 1.f : 0.f, args.sampleTime);
+        return 0;
     }
 
 	void process(const ProcessArgs& args) override {
-        computeInputBytes(args);
-
-        /* Set accumulator parameters */
-        resetUTrig.process(inputs[RESET_INPUT].getVoltage());
-        clockUTrig.process(inputs[CLOCK_INPUT].getVoltage());
-        shiftUTrig.process(inputs[SHIFT_INPUT].getVoltage());
-        shiftDataUTrig.process(
-                inputs[SHIFT_DATA_INPUT].isConnected()
-                ? inputs[SHIFT_DATA_INPUT].getVoltage()
-                : out8);
-        shiftXorUTrig.process(inputs[DATA_XOR_INPUT].getVoltage());
-
-        bool resetButtonDown = params[RESET_PARAM].getValue() > 0.5f;
-        /* reset light is only based on the button, not the jack input */
-        lights[RESET_LIGHT].setBrightnessSmooth(resetButtonDown, args.sampleTime);
+        PROFILE_FRAME(profile);
+        if (isCascadeFollower()) {
+            processFollower(args);
+            return;
+        }
+        auto& engineSet = engineSets.acquire();
+        auto& engines = engineSet.engines;
+        int blockSize = engineSet.config.blockSize;
+
+        // with busInputs set, unpatched gates are normalled to the bit streams of a BTFLD or BTMX on the left. The bus
+        // only counts, and only widens the polyphony, while one of them is unpatched.
+        bool busNormalled = false;
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            busNormalled |= !inputs[gateInputIds[b]].isConnected();
+        }
+        const BusMessage* busIn = busInputs && busNormalled ? readBus(this) : nullptr;
 
-        bool async = (params[ASYNC_SYNC_PARAM].getValue() > 0.5f) || !inputs[CLOCK_INPUT].isConnected();
+        // until the widget has built engines for a longer cascade, the Nibblers past the followers they were built for
+        // keep their last outputs
+        std::array<Nibbler*, NIBBLER_MAX_CASCADE - 1> followers;
+        int numFollowers = std::min(getCascadeFollowers(followers), engineSet.config.followers);
 
-        for (auto s = 0; s < NIBBLER_UPSAMPLE_RATIO; ++s) {
-            inputBytes[s] += nibbleRegister.heldValue;
-            shiftDataUTrig.trigger.process(shiftDataUTrig.input[s]);
-            shiftXorUTrig.trigger.process(shiftXorUTrig.input[s]);
+        int channels = std::max(1, busIn ? busIn->channels : 0);
+        for (auto i = 0; i < INPUTS_LEN; ++i) {
+            channels = std::max(channels, inputs[i].getChannels());
+        }
+        for (auto k = 0; k < numFollowers; ++k) {
+            for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                channels = std::max(channels, followers[k]->inputs[gateInputIds[b]].getChannels());
+            }
+        }
+        for (auto g = 0; g < PORT_MAX_CHANNELS / 4; ++g) {
+            engines[g]->setCascade(g * 4 < channels ? numFollowers : 0);
+        }
 
-            auto hiShift = shiftUTrig.trigger.process(shiftUTrig.input[s], 0.1f, 1.f);
-            auto hiClock = clockUTrig.trigger.process(clockUTrig.input[s], 0.1f, 1.f);
+        NibblerControls controls;
 
-            hiClock = async ? (hiClock || hiShift) : hiClock;
+        controls.add = getAdd();
 
-            auto s1 = inputs[SHIFT_DATA_INPUT].isConnected() ? shiftDataUTrig.trigger.isHigh() : out8;
-            auto s2 = shiftXorUTrig.trigger.isHigh();
+        controls.subtractSwitch = (params[SUBTRACT_ADD_PARAM].getValue() > 0.5f);
+        controls.resetButtonDown = params[RESET_PARAM].getValue() > 0.5f;
+        controls.async = (params[ASYNC_SYNC_PARAM].getValue() > 0.5f) || !inputs[CLOCK_INPUT].isConnected();
+        controls.shiftDataConnected = inputs[SHIFT_DATA_INPUT].isConnected();
 
-            auto shiftDataInput = (s1 != s2);
+        controls.stepOffset = getStepOffset();
 
-            resetUTrig.trigger.process(resetUTrig.input[s], 0.1f, 1.f);
+        std::array<unsigned char, NIBBLER_MAX_CASCADE - 1> followerAdd, followerStepOffset;
+        std::array<NibblerCascadeMessage*, NIBBLER_MAX_CASCADE - 1> followerMessages;
+        for (auto k = 0; k < numFollowers; ++k) {
+            followerAdd[k] = followers[k]->getAdd();
+            followerStepOffset[k] = followers[k]->getStepOffset();
+            followerMessages[k] = static_cast<NibblerCascadeMessage*>(followers[k]->leftExpander.producerMessage);
+            followerMessages[k]->channels = channels;
+        }
+
+        NibblerInputs in;
+        for (auto c = 0; c < channels; c += 4) {
+            auto& engine = *engines[c / 4];
+
+            const BusGroup* busGroup = busIn && c < busIn->channels ? &busIn->groups[c / 4] : nullptr;
+            engine.bus = BusInput();
+            for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                in.gates[b] = inputs[gateInputIds[b]].getPolyVoltageSimd<float_4>(c);
+                if (busGroup && !inputs[gateInputIds[b]].isConnected()) {
+                    in.gates[b] = busFrameVoltage(busGroup->states[b], busIn->ratio);
+                    engine.bus.inputs |= 1 << b;
+                }
+            }
+            if (busGroup && blockSize == 0) {
+                engine.bus.group = busGroup;
+                engine.bus.ratio = busIn->ratio;
+            }
+            in.carryIn = inputs[CARRY_IN_INPUT].getPolyVoltageSimd<float_4>(c);
+            in.subtract = inputs[SUB_INPUT].getPolyVoltageSimd<float_4>(c);
+            in.reset = inputs[RESET_INPUT].getPolyVoltageSimd<float_4>(c);
+            in.clock = inputs[CLOCK_INPUT].getPolyVoltageSimd<float_4>(c);
+            in.shift = inputs[SHIFT_INPUT].getPolyVoltageSimd<float_4>(c);
+            in.shiftData = inputs[SHIFT_DATA_INPUT].getPolyVoltageSimd<float_4>(c);
+            in.shiftXor = inputs[DATA_XOR_INPUT].getPolyVoltageSimd<float_4>(c);
+
+            for (auto k = 0; k < numFollowers; ++k) {
+                for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+                    engine.cascadeIn.gates[k][b] = followers[k]->inputs[gateInputIds[b]].getPolyVoltageSimd<float_4>(c);
+                }
+                engine.cascadeIn.add[k] = followerAdd[k];
+                engine.cascadeIn.stepOffset[k] = followerStepOffset[k];
+            }
 
-            nibbleRegister.process(inputBytes[s],
-                                   shiftUTrig.trigger.isHigh(),
-                                   shiftDataInput,
-                                   hiClock,
-                                   (resetUTrig.trigger.isHigh() || resetButtonDown));
-            if (async) {
-                accumulatorOutBytes[s] = inputBytes[s];
+            // in block mode the outputs lag by blockSize frames, bit 8 feeds an unpatched shift data input without it.
+            // A cascade always runs frame by frame.
+            std::array<float_4, NIBBLER_NUM_BITS + 3> out;
+            if (blockSize > 0 && numFollowers == 0) {
+                auto& frameBlock = (*engineSet.frameBlocks)[c / 4];
+                if (frameBlock.push(in.toFrame(), out, blockSize)) {
+                    engine.processBlock(frameBlock, blockSize, controls);
+                }
             } else {
-                // carry always comes from the summed input bytes, it is not held in the register
-                accumulatorOutBytes[s] = nibbleRegister.heldValue | (inputBytes[s] & 16);
+                engine.process(in, controls);
+                engine.getOutputs(out);
             }
-        }
 
-        lights[CLOCK_LIGHT].setBrightnessSmooth(clockUTrig.trigger.isHigh(), args.sampleTime);
-        lights[SHIFT_LIGHT].setBrightnessSmooth(shiftUTrig.trigger.isHigh(), args.sampleTime);
-        lights[SHIFT_DATA_LIGHT].setBrightnessSmooth(inputs[SHIFT_DATA_INPUT].isConnected() ? shiftDataUTrig.trigger.isHigh() : out8, args.sampleTime);
-        lights[DATA_XOR_LIGHT].setBrightnessSmooth(shiftXorUTrig.trigger.isHigh(), args.sampleTime);
+            if (numFollowers > 0) {
+                for (auto k = 0; k < numFollowers; ++k) {
+                    engine.cascadeOutputs(k).getOutputs(followerMessages[k]->outputs[c / 4]);
+                }
+                // the followers get theirs next frame
+                std::swap(out, cascadeDelay[c / 4]);
+            }
 
+            for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
+                outputs[outputBitIds[b]].setVoltageSimd(out[b], c);
+            }
+            outputs[STEP_OUTPUT].setVoltageSimd(out[NIBBLER_NUM_BITS + 1], c);
+            outputs[OFFSET_STEP_OUTPUT].setVoltageSimd(out[NIBBLER_NUM_BITS + 2], c);
+        }
 
+        for (auto o = 0; o < OUTPUTS_LEN; ++o) {
+            outputs[o].setChannels(channels);
+        }
+        for (auto k = 0; k < numFollowers; ++k) {
+            followers[k]->leftExpander.requestMessageFlip();
+        }
 
+        if (lightDivider.process()) {
+            PROFILE_START();
+            updateLights(args.sampleTime * lightDivider.getDivision(), controls);
+            PROFILE_LAP(PROFILE_LIGHTS);
+        }
+    }
 
-        for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
-            for (auto s = 0; s < NIBBLER_UPSAMPLE_RATIO; ++s) {
-                auto outByte = async ? inputBytes[s] : accumulatorOutBytes[s];
-                upsampledBitOutput[b][s] = (outByte & (1 << b)) ? gateVoltage : 0.f;
-            }
-            auto outVolt = bitOutDecimators[b].process(upsampledBitOutput[b].data());
-            lights[outputLightIds[b]].setBrightnessSmooth(outVolt * 0.1f, args.sampleTime);
-            outputs[outputBitIds[b]].setVoltage(outVolt);
-            if (b == 3) {
-                out8 = outVolt;
+    // A follower only passes on what the leader of its cascade computed in the previous frame
+    void processFollower(const ProcessArgs& args) {
+        auto message = static_cast<const NibblerCascadeMessage*>(leftExpander.consumerMessage);
+        int channels = std::max(message->channels, 1);
+        for (auto c = 0; c < channels; c += 4) {
+            auto& out = message->outputs[c / 4];
+            for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
+                outputs[outputBitIds[b]].setVoltageSimd(out[b], c);
             }
+            outputs[STEP_OUTPUT].setVoltageSimd(out[NIBBLER_NUM_BITS + 1], c);
+            outputs[OFFSET_STEP_OUTPUT].setVoltageSimd(out[NIBBLER_NUM_BITS + 2], c);
+        }
+        for (auto o = 0; o < OUTPUTS_LEN; ++o) {
+            outputs[o].setChannels(channels);
         }
 
-        std::fill(stepDecimatorInput.begin(), stepDecimatorInput.end(), 0);
-        std::fill(offsetStepDecimatorInput.begin(), offsetStepDecimatorInput.end(), 0);
+        if (lightDivider.process()) {
+            PROFILE_START();
+            updateFollowerLights(args.sampleTime * lightDivider.getDivision(), message->outputs[0]);
+            PROFILE_LAP(PROFILE_LIGHTS);
+        }
+    }
 
-        auto s1 = params[OFFSET_1_PARAM].getValue() > 0.5f;
-        auto s2 = params[OFFSET_2_PARAM].getValue() > 0.5f;
+    // the gates and outputs of the first channel, the inputs the leader takes over stay dark
+    void updateFollowerLights(float lightTime, const std::array<float_4, NIBBLER_NUM_BITS + 3>& out) {
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            lights[gateLightIds[b]].setBrightnessSmooth(inputs[gateInputIds[b]].getVoltage() >= 1.f ? 1.f : 0.f,
+                                                        lightTime);
+        }
+        for (auto light : {CARRY_IN_LIGHT, SUB_LIGHT, RESET_LIGHT, CLOCK_LIGHT, SHIFT_LIGHT, SHIFT_DATA_LIGHT,
+                           DATA_XOR_LIGHT}) {
+            lights[light].setBrightnessSmooth(0.f, lightTime);
+        }
+        int bits = 0;
+        for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
+            lights[outputLightIds[b]].setBrightnessSmooth(out[b][0] * 0.1f, lightTime);
+            bits |= out[b][0] > 5.f ? 1 << b : 0;
+        }
+        lights[STEP_LIGHT].setBrightnessSmooth(out[NIBBLER_NUM_BITS + 1][0] * 0.1f, lightTime);
+        lights[OFFSET_STEP_LIGHT].setBrightnessSmooth(out[NIBBLER_NUM_BITS + 2][0] * 0.1f, lightTime);
+        bitHistory.push(packBitState(bits, out[NIBBLER_NUM_BITS + 1][0] * 0.1f));
+    }
 
-        unsigned char stepOffset = 0;
+    // lights and the bit history follow the first channel
+    void updateLights(float lightTime, const NibblerControls& controls) {
+        auto& first = *engineSets.current->engines[0];
+        auto high = [](int state) { return (state & 1) ? 1.f : 0.f; };
 
-        if (s1 && !s2) {
-            stepOffset = 4;
-        } else if (!s1 && s2) {
-            stepOffset = 2;
-        } else if (s1 && s2) {
-            stepOffset = 8;
+        for (auto b = 0; b < NIBBLER_NUM_BITS; ++b) {
+            lights[gateLightIds[b]].setBrightnessSmooth(high(first.gateState[b]), lightTime);
         }
+        lights[CARRY_IN_LIGHT].setBrightnessSmooth(high(first.carryInState), lightTime);
+        lights[SUB_LIGHT].setBrightnessSmooth((controls.subtractSwitch != (high(first.subtractState) > 0.5f)) ? 1.f : 0.f, lightTime);
 
-        for (auto s = 0; s < NIBBLER_UPSAMPLE_RATIO; ++s) {
-            auto outByte = async ? inputBytes[s] : accumulatorOutBytes[s];
-            stepDecimatorInput[s] = static_cast<float>(outByte & 15) * (gateVoltage / 16.f);
-            offsetStepDecimatorInput[s] = static_cast<float>((outByte + stepOffset) & 15) * (gateVoltage / 16.f);
-        }
+        /* reset light is only based on the button, not the jack input */
+        lights[RESET_LIGHT].setBrightnessSmooth(controls.resetButtonDown, lightTime);
 
-        auto stepOut = stepDecimator.process(stepDecimatorInput.data());
-        outputs[STEP_OUTPUT].setVoltage(stepOut);
-        lights[STEP_LIGHT].setBrightnessSmooth(stepOut * 0.1f, args.sampleTime);
+        lights[CLOCK_LIGHT].setBrightnessSmooth(high(first.clockState), lightTime);
+        lights[SHIFT_LIGHT].setBrightnessSmooth(high(first.shiftState), lightTime);
+        lights[SHIFT_DATA_LIGHT].setBrightnessSmooth(controls.shiftDataConnected ? high(first.shiftDataState) : first.out8[0], lightTime);
+        lights[DATA_XOR_LIGHT].setBrightnessSmooth(high(first.shiftXorState), lightTime);
 
-        auto offsetStepOut = offsetStepDecimator.process(offsetStepDecimatorInput.data());
-        outputs[OFFSET_STEP_OUTPUT].setVoltage(offsetStepOut);
-        lights[OFFSET_STEP_LIGHT].setBrightnessSmooth(offsetStepOut * 0.1f, args.sampleTime);
+        // the four bits and carry out
+        int bits = 0;
+        for (auto b = 0; b < NIBBLER_NUM_BITS + 1; ++b) {
+            lights[outputLightIds[b]].setBrightnessSmooth(first.bitOut[b][0] * 0.1f, lightTime);
+            bits |= first.bitOut[b][0] > 5.f ? 1 << b : 0;
+        }
+        lights[STEP_LIGHT].setBrightnessSmooth(first.stepOut[0] * 0.1f, lightTime);
+        lights[OFFSET_STEP_LIGHT].setBrightnessSmooth(first.offsetStepOut[0] * 0.1f, lightTime);
+        bitHistory.push(packBitState(bits, first.stepOut[0] * 0.1f));
     }
 };
 
@@ -404,7 +1466,44 @@ struct NibblerWidget : ModuleWidget {
 		addChild(createLightCentered<MediumLight<BlueLight>>(mm2px(Vec(29.855, 105.19)), module, Nibbler::DATA_XOR_LIGHT));
 		addChild(createLightCentered<MediumLight<BlueLight>>(mm2px(Vec(42.861, 105.19)), module, Nibbler::GATE_1_LIGHT));
 		addChild(createLightCentered<MediumLight<BlueLight>>(mm2px(Vec(55.868, 105.19)), module, Nibbler::OUT_1_LIGHT));
+
+        addChild(createBitHistoryDisplay(mm2px(Vec(2.5, 116.6)), mm2px(Vec(55.96, 5.4)), module, NIBBLER_NUM_BITS + 1));
 	}
+
+    // cascades form and break up as Nibblers are moved or set in the menu, the leader's engines follow off the audio
+    // thread
+    void step() override {
+        if (auto module = getModule<Nibbler>()) {
+            module->updateEngines();
+        }
+        ModuleWidget::step();
+    }
+
+    void appendContextMenu(Menu* menu) override {
+        auto module = getModule<Nibbler>();
+        if (!module) {
+            return;
+        }
+        menu->addChild(new MenuSeparator);
+        auto update = [=]() { module->updateEngines(); };
+        menu->addChild(createIndexSubmenuItem("Output engine", {"Oversampled", "Band-limited steps (minBLEP)"},
+            [=]() -> size_t {
+                return module->engineType;
+            },
+            [=](size_t index) {
+                module->engineType = index;
+                update();
+            }));
+        appendOversamplingMenu(menu, &module->oversampling, module->sampleRate, NIBBLER_UPSAMPLE_RATIO, update);
+        appendGateInputMenu(menu, &module->gateInputs, update);
+        appendBlockMenu(menu, &module->blockProcessing, module->sampleRate, update);
+        appendBitHistoryMenu(menu, &module->bitHistorySettings);
+        menu->addChild(createBoolPtrMenuItem("Extend the Nibbler on the left", "", &module->cascade));
+        menu->addChild(createBoolPtrMenuItem("Normal the gates to the module on the left", "", &module->busInputs));
+#ifdef SCHLAPPI_PROFILE
+        appendProfileMenu(menu, &module->profile, "Nibbler");
+#endif
+    }
 };
 
 
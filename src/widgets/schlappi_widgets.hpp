@@ -6,41 +6,178 @@
 #define SCHLAPPI_VCV_SCHLAPPI_WIDGETS_H
 
 #include "plugin.hpp"
+#include "dsp/telemetry.hpp"
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
 
-struct SchlappiToggleVertical2pos : rack::app::SvgSwitch {
+// A widget graphic with its light and dark panel variants, loaded once when the widget is created. Graphics without
+// dark artwork pass the same path twice.
+struct SchlappiThemedSvg {
+    std::shared_ptr<window::Svg> light;
+    std::shared_ptr<window::Svg> dark;
+
+    SchlappiThemedSvg(const std::string& lightPath, const std::string& darkPath)
+        : light(APP->window->loadSvg(rack::asset::plugin(pluginInstance, lightPath))),
+          dark(darkPath == lightPath ? light : APP->window->loadSvg(rack::asset::plugin(pluginInstance, darkPath))) {}
+
+    std::shared_ptr<window::Svg> get(bool preferDark) const {
+        return preferDark ? dark : light;
+    }
+};
+
+// Switch whose frames follow the panel theme. The frames are only replaced, and the framebuffer only redrawn, when a
+// theme change event reports a different theme than the one shown.
+struct SchlappiThemedSwitch : rack::app::SvgSwitch {
+    std::vector<SchlappiThemedSvg> themedFrames;
+    bool dark = false;
+
+    void addThemedFrame(const std::string& lightPath, const std::string& darkPath) {
+        themedFrames.emplace_back(lightPath, darkPath);
+        addFrame(themedFrames.back().get(dark));
+    }
+
+    void onThemeChange(const ThemeChangeEvent& e) override {
+        if (settings::preferDarkPanels != dark) {
+            dark = settings::preferDarkPanels;
+            for (size_t i = 0; i < themedFrames.size(); ++i) {
+                frames[i] = themedFrames[i].get(dark);
+            }
+            // shows the frame for the current value again
+            ChangeEvent change;
+            onChange(change);
+            fb->setDirty();
+        }
+        SvgSwitch::onThemeChange(e);
+    }
+};
+
+struct SchlappiToggleVertical2pos : SchlappiThemedSwitch {
     SchlappiToggleVertical2pos() {
-        addFrame(APP->window->loadSvg(rack::asset::plugin(pluginInstance, "res/widgets/toggle-0.svg")));
-        addFrame(APP->window->loadSvg(rack::asset::plugin(pluginInstance, "res/widgets/toggle-1.svg")));
+        dark = settings::preferDarkPanels;
+        addThemedFrame("res/widgets/toggle-0.svg", "res/widgets/toggle-0.svg");
+        addThemedFrame("res/widgets/toggle-1.svg", "res/widgets/toggle-1.svg");
     }
 };
 
-struct SchlappiCherryMXBrown : rack::app::SvgSwitch {
+struct SchlappiCherryMXBrown : SchlappiThemedSwitch {
     SchlappiCherryMXBrown() {
         momentary = true;
-        addFrame(APP->window->loadSvg(rack::asset::plugin(pluginInstance, "res/widgets/keyboard-button-0.svg")));
-        addFrame(APP->window->loadSvg(rack::asset::plugin(pluginInstance, "res/widgets/keyboard-button-1.svg")));
+        dark = settings::preferDarkPanels;
+        addThemedFrame("res/widgets/keyboard-button-0.svg", "res/widgets/keyboard-button-0.svg");
+        addThemedFrame("res/widgets/keyboard-button-1.svg", "res/widgets/keyboard-button-1.svg");
     }
 };
 
 struct SchlappiSilverKnob : RoundKnob {
+    SchlappiThemedSvg knobSvg{"res/widgets/silver-knob.svg", "res/widgets/silver-knob-dark.svg"};
+    SchlappiThemedSvg bgSvg{"res/widgets/silver-knob-bg.svg", "res/widgets/silver-knob-bg-dark.svg"};
+    bool dark;
+
     SchlappiSilverKnob() {
-        setSvgs();
+        dark = settings::preferDarkPanels;
+        setSvg(knobSvg.get(dark));
+        bg->setSvg(bgSvg.get(dark));
+    }
+
+    void onThemeChange(const ThemeChangeEvent& e) override {
+        if (settings::preferDarkPanels != dark) {
+            dark = settings::preferDarkPanels;
+            setSvg(knobSvg.get(dark));
+            bg->setSvg(bgSvg.get(dark));
+            fb->setDirty();
+        }
+        RoundKnob::onThemeChange(e);
     }
+};
+
+// Scrolling bit history of a module, newest on the right. Each bit gets a row, bit 0 at the bottom, with the step output
+// traced over them. A column ORs the bits of every entry it covers, so pulses shorter than a column still show.
+struct BitHistoryDisplay : TransparentWidget {
+    BitHistory* history = nullptr;
+    BitHistorySettings* settings = nullptr;
+    int numBits = 4;
+    std::array<BitState, TELEMETRY_HISTORY_LENGTH> entries;
 
-    void setSvgs() {
-        setSvg(APP->window->loadSvg(settings::preferDarkPanels
-            ? rack::asset::plugin(pluginInstance, "res/widgets/silver-knob-dark.svg")
-            : rack::asset::plugin(pluginInstance, "res/widgets/silver-knob.svg")));
-        bg->setSvg(APP->window->loadSvg(settings::preferDarkPanels
-            ? rack::asset::plugin(pluginInstance, "res/widgets/silver-knob-bg-dark.svg")
-            : rack::asset::plugin(pluginInstance, "res/widgets/silver-knob-bg.svg")));
+    bool isVisible() {
+        return history && settings && settings->visible;
+    }
 
+    void draw(const DrawArgs& args) override {
+        if (!isVisible()) {
+            return;
+        }
+        nvgBeginPath(args.vg);
+        nvgRoundedRect(args.vg, 0.f, 0.f, box.size.x, box.size.y, 1.5f);
+        nvgFillColor(args.vg, nvgRGB(0x10, 0x10, 0x14));
+        nvgFill(args.vg);
     }
 
-    void step() override {
-        setSvgs();
-        RoundKnob::step();
+    void drawLayer(const DrawArgs& args, int layer) override {
+        if (layer != 1 || !isVisible()) {
+            TransparentWidget::drawLayer(args, layer);
+            return;
+        }
+        int count = history->read(entries.data(), TELEMETRY_HISTORY_LENGTH);
+        int columns = static_cast<int>(box.size.x);
+        if (count == 0 || columns <= 0) {
+            return;
+        }
+        int perColumn = std::max(1, count / columns);
+        columns = std::min(columns, count / perColumn);
+        float rowHeight = box.size.y / numBits;
+        float left = box.size.x - columns;
+
+        NVGcolor color = SCHEME_BLUE;
+        for (auto b = 0; b < numBits; ++b) {
+            // one rect per run of set columns
+            nvgBeginPath(args.vg);
+            int runStart = -1;
+            for (auto x = 0; x <= columns; ++x) {
+                bool set = false;
+                for (auto e = 0; x < columns && e < perColumn; ++e) {
+                    set = set || (bitStateBits(entries[count - (columns - x) * perColumn + e]) & (1 << b));
+                }
+                if (set && runStart < 0) {
+                    runStart = x;
+                } else if (!set && runStart >= 0) {
+                    nvgRect(args.vg, left + runStart, box.size.y - (b + 1) * rowHeight + 0.5f, x - runStart,
+                            rowHeight - 1.f);
+                    runStart = -1;
+                }
+            }
+            nvgFillColor(args.vg, nvgTransRGBA(color, 0x90));
+            nvgFill(args.vg);
+        }
+
+        nvgBeginPath(args.vg);
+        for (auto x = 0; x < columns; ++x) {
+            float step = bitStateStep(entries[count - (columns - x - 1) * perColumn - 1]);
+            float y = (1.f - step) * box.size.y;
+            if (x == 0) {
+                nvgMoveTo(args.vg, left, y);
+            } else {
+                nvgLineTo(args.vg, left + x, y);
+            }
+        }
+        nvgStrokeColor(args.vg, nvgRGB(0xff, 0xff, 0xff));
+        nvgStrokeWidth(args.vg, 1.f);
+        nvgStroke(args.vg);
     }
 };
 
+// Places a BitHistoryDisplay at pos, in the module's panel coordinates
+template <typename TModule>
+BitHistoryDisplay* createBitHistoryDisplay(math::Vec pos, math::Vec size, TModule* module, int numBits) {
+    auto display = createWidget<BitHistoryDisplay>(pos);
+    display->box.size = size;
+    display->numBits = numBits;
+    if (module) {
+        display->history = &module->bitHistory;
+        display->settings = &module->bitHistorySettings;
+    }
+    return display;
+}
+
 #endif //SCHLAPPI_VCV_SCHLAPPI_WIDGETS_H
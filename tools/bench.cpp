@@ -0,0 +1,295 @@
+// Headless microbenchmark for the BTFLD, BTMX and Nibbler DSP paths.
+//
+// Usage: schlappi-bench [-n frames] [-r sampleRate] [-c channels[,channels...]] [-b blockSize] [--csv] [--check]
+//                       [filter]
+//
+// Every case is run once per channel count, with block processing when -b is given. Input signals are precomputed so
+// that only Module::process() is timed. With --check, cases that have a CPU budget fail the run when they go over it.
+
+#include "headless.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Stimulus {
+    int inputId;
+    float (*signal)(int64_t frame, float sampleRate, float frequency, int channel);
+    float frequency;
+    float amplitude;
+};
+
+struct BenchCase {
+    std::string name;
+    // creates the module and sets its parameters
+    std::function<Module*()> create;
+    std::vector<Stimulus> stimuli;
+    // real-time load one polyphony group may take, in percent of one core, or 0 for no budget
+    double budget = 0.0;
+};
+
+struct BenchResult {
+    double nsPerSample;
+    double samplesPerSecond;
+    // percentage of one core needed to run this instance in real time
+    double realtimeLoad;
+    // memory held by the instance
+    size_t stateBytes;
+};
+
+static const int TABLE_LENGTH = 48000;
+static const int WARMUP_FRAMES = 4800;
+
+static volatile float sink;
+
+#ifdef SCHLAPPI_LOW_COST
+// Budgets for the default engine of each module in the low-cost profile, measured on a desktop core. They are
+// provisional: they assume a MetaModule core is roughly ten times slower, which has not been calibrated on the hardware
+// yet, and leave room for eight or more modules per patch under that assumption.
+static const double BTFLD_BUDGET = 2.0;
+static const double BTMX_BUDGET = 2.5;
+static const double NIBBLER_BUDGET = 5.0;
+#else
+static const double BTFLD_BUDGET = 0.0;
+static const double BTMX_BUDGET = 0.0;
+static const double NIBBLER_BUDGET = 0.0;
+#endif
+
+static BenchResult run(const BenchCase& bench, int channels, int64_t frames, float sampleRate, int blockSize) {
+    std::unique_ptr<Module> module(bench.create());
+    json_t* rootJ = json_object();
+    json_object_set_new(rootJ, "blockSize", json_integer(blockSize));
+    module->dataFromJson(rootJ);
+    json_decref(rootJ);
+    headless::setSampleRate(module.get(), sampleRate);
+    headless::connectOutputs(module.get());
+
+    std::vector<std::vector<float>> tables;
+    for (auto& stimulus : bench.stimuli) {
+        headless::connect(module->inputs[stimulus.inputId], channels);
+        std::vector<float> table(TABLE_LENGTH * channels);
+        for (auto f = 0; f < TABLE_LENGTH; ++f) {
+            for (auto c = 0; c < channels; ++c) {
+                table[f * channels + c] = stimulus.amplitude * stimulus.signal(f, sampleRate, stimulus.frequency, c);
+            }
+        }
+        tables.push_back(std::move(table));
+    }
+
+    auto step = [&](int64_t frame) {
+        auto t = frame % TABLE_LENGTH;
+        for (size_t i = 0; i < bench.stimuli.size(); ++i) {
+            std::memcpy(module->inputs[bench.stimuli[i].inputId].voltages,
+                        &tables[i][t * channels], channels * sizeof(float));
+        }
+        module->process(headless::processArgs(sampleRate, frame));
+    };
+
+    for (int64_t frame = 0; frame < WARMUP_FRAMES; ++frame) {
+        step(frame);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    float accumulated = 0.f;
+    for (int64_t frame = WARMUP_FRAMES; frame < WARMUP_FRAMES + frames; ++frame) {
+        step(frame);
+        accumulated += module->outputs[0].getVoltage();
+    }
+    auto end = std::chrono::steady_clock::now();
+    sink = accumulated;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    BenchResult result;
+    result.nsPerSample = seconds * 1e9 / frames;
+    result.samplesPerSecond = frames / seconds;
+    result.realtimeLoad = 100.0 * sampleRate / result.samplesPerSecond;
+    result.stateBytes = headless::stateBytes(module.get());
+    return result;
+}
+
+static std::vector<BenchCase> benchCases() {
+    std::vector<BenchCase> cases;
+
+    const char* btfldEngineNames[] = {"", "/adaa", "/adaa2x"};
+    for (auto resolution : {4, 8})
+    for (auto engineType : {Btfld::OVERSAMPLED_ENGINE, Btfld::ADAA_ENGINE, Btfld::ADAA_2X_ENGINE})
+    for (auto bipolar : {false, true}) {
+        BenchCase bench;
+        bench.name = std::string(bipolar ? "btfld/bipolar" : "btfld/unipolar") + btfldEngineNames[engineType];
+        if (resolution != NIBBLE) {
+            bench.name += string::f("/%dbit", resolution);
+        }
+        bench.budget = engineType == Btfld::DEFAULT_ENGINE && resolution == NIBBLE ? BTFLD_BUDGET : 0.0;
+        bench.create = [engineType, bipolar, resolution]() {
+            auto module = new Btfld;
+            module->engineType = engineType;
+            module->resolution = resolution;
+            module->updateEngines();
+            module->params[Btfld::GAIN_PARAM].setValue(1.3f);
+            module->params[Btfld::CV_PARAM].setValue(0.5f);
+            module->params[Btfld::RANGE_PARAM].setValue(bipolar ? 1.f : 0.f);
+            return module;
+        };
+        bench.stimuli = {
+            {Btfld::INPUT_INPUT, headless::sine, 110.f, 5.f},
+            {Btfld::INJECT_INPUT, headless::sine, 0.5f, 2.f},
+        };
+        cases.push_back(bench);
+    }
+
+    const char* logicModeNames[] = {"and", "add", "or", "xor"};
+    for (auto edgeTimed : {false, true})
+    for (auto engineType : {BTMX::OVERSAMPLED_ENGINE, BTMX::MINBLEP_ENGINE})
+    for (auto logicMode = 0; logicMode < 4; ++logicMode) {
+        // the minBLEP engine times its edges either way
+        if (edgeTimed && engineType == BTMX::MINBLEP_ENGINE) {
+            continue;
+        }
+        BenchCase bench;
+        bench.name = std::string("btmx/") + logicModeNames[logicMode];
+        if (engineType == BTMX::MINBLEP_ENGINE) {
+            bench.name += "/minblep";
+        }
+        if (edgeTimed) {
+            bench.name += "/edges";
+        }
+        bench.budget = engineType == BTMX::DEFAULT_ENGINE && !edgeTimed ? BTMX_BUDGET : 0.0;
+        bench.create = [engineType, logicMode, edgeTimed]() {
+            auto module = new BTMX;
+            module->engineType = engineType;
+            module->gateInputs.edgeTimed = edgeTimed;
+            module->updateEngines();
+            module->params[BTMX::LOGIC_MODE_A].setValue((logicMode & 2) ? 1.f : 0.f);
+            module->params[BTMX::LOGIC_MODE_B].setValue((logicMode & 1) ? 1.f : 0.f);
+            for (auto i = 0; i < 8; ++i) {
+                module->params[BTMX::SWITCH_PARAM + i].setValue(1.f);
+            }
+            return module;
+        };
+        const float frequencies[] = {20.f, 30.f, 50.f, 70.f, 110.f, 130.f, 170.f, 190.f};
+        for (auto i = 0; i < 8; ++i) {
+            bench.stimuli.push_back({BTMX::IN_INPUT + i, headless::gate, frequencies[i], 1.f});
+        }
+        cases.push_back(bench);
+    }
+
+    for (auto edgeTimed : {false, true})
+    for (auto engineType : {Nibbler::OVERSAMPLED_ENGINE, Nibbler::MINBLEP_ENGINE})
+    for (auto sync : {false, true}) {
+        BenchCase bench;
+        bench.name = sync ? "nibbler/sync" : "nibbler/async";
+        if (engineType == Nibbler::MINBLEP_ENGINE) {
+            bench.name += "/minblep";
+        }
+        if (edgeTimed) {
+            bench.name += "/edges";
+        }
+        bench.budget = engineType == Nibbler::DEFAULT_ENGINE && !edgeTimed ? NIBBLER_BUDGET : 0.0;
+        bench.create = [engineType, sync, edgeTimed]() {
+            auto module = new Nibbler;
+            module->engineType = engineType;
+            module->gateInputs.edgeTimed = edgeTimed;
+            module->updateEngines();
+            module->params[Nibbler::ADD_1_PARAM].setValue(1.f);
+            module->params[Nibbler::ADD_4_PARAM].setValue(1.f);
+            module->params[Nibbler::OFFSET_1_PARAM].setValue(1.f);
+            module->params[Nibbler::ASYNC_SYNC_PARAM].setValue(sync ? 0.f : 1.f);
+            return module;
+        };
+        bench.stimuli = {
+            {Nibbler::GATE_1_INPUT, headless::gate, 30.f, 1.f},
+            {Nibbler::GATE_2_INPUT, headless::gate, 50.f, 1.f},
+            {Nibbler::GATE_4_INPUT, headless::gate, 70.f, 1.f},
+            {Nibbler::GATE_8_INPUT, headless::gate, 110.f, 1.f},
+            {Nibbler::CARRY_IN_INPUT, headless::gate, 13.f, 1.f},
+        };
+        if (sync) {
+            bench.stimuli.push_back({Nibbler::CLOCK_INPUT, headless::gate, 1000.f, 1.f});
+        }
+        cases.push_back(bench);
+    }
+
+    return cases;
+}
+
+static void usage(const char* argv0) {
+    std::fprintf(stderr, "usage: %s [-n frames] [-r sampleRate] [-c channels[,channels...]] [-b blockSize] [--csv] "
+                         "[--check] [filter]\n", argv0);
+}
+
+int main(int argc, char** argv) {
+    int64_t frames = 480000;
+    float sampleRate = 48000.f;
+    std::vector<int> channelCounts = {1, 16};
+    int blockSize = 0;
+    bool csv = false;
+    bool check = false;
+    std::string filter;
+
+    for (auto i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            frames = std::atoll(argv[++i]);
+        } else if (arg == "-r" && i + 1 < argc) {
+            sampleRate = std::atof(argv[++i]);
+        } else if (arg == "-c" && i + 1 < argc) {
+            channelCounts.clear();
+            for (char* token = std::strtok(argv[++i], ","); token; token = std::strtok(nullptr, ",")) {
+                channelCounts.push_back(clamp(std::atoi(token), 1, PORT_MAX_CHANNELS));
+            }
+        } else if (arg == "-b" && i + 1 < argc) {
+            blockSize = std::atoi(argv[++i]);
+        } else if (arg == "--csv") {
+            csv = true;
+        } else if (arg == "--check") {
+            check = true;
+        } else if (arg == "-h" || arg == "--help" || (!arg.empty() && arg[0] == '-')) {
+            usage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        } else {
+            filter = arg;
+        }
+    }
+    if (frames <= 0 || sampleRate <= 0.f || channelCounts.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (csv) {
+        std::printf("case,channels,ns_per_sample,samples_per_second,realtime_load_percent,state_bytes\n");
+    } else {
+        std::printf("%-24s %8s %14s %16s %12s %12s\n", "case", "channels", "ns/sample", "samples/sec", "load @ rate",
+                    "state bytes");
+    }
+
+    bool overBudget = false;
+    for (auto& bench : benchCases()) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        for (auto channels : channelCounts) {
+            auto result = run(bench, channels, frames, sampleRate, blockSize);
+            if (csv) {
+                std::printf("%s,%d,%.2f,%.0f,%.3f,%zu\n", bench.name.c_str(), channels,
+                            result.nsPerSample, result.samplesPerSecond, result.realtimeLoad, result.stateBytes);
+            } else {
+                std::printf("%-24s %8d %14.1f %16.0f %11.2f%% %12zu\n", bench.name.c_str(), channels,
+                            result.nsPerSample, result.samplesPerSecond, result.realtimeLoad, result.stateBytes);
+            }
+            std::fflush(stdout);
+
+            double budget = bench.budget * ((channels + 3) / 4);
+            if (check && budget > 0.0 && result.realtimeLoad > budget) {
+                std::fprintf(stderr, "%s with %d channels is over its provisional budget: %.2f%% > %.2f%%\n", bench.name.c_str(),
+                             channels, result.realtimeLoad, budget);
+                overBudget = true;
+            }
+        }
+    }
+    return overBudget ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+#ifndef SCHLAPPI_VCV_HEADLESS_H
+#define SCHLAPPI_VCV_HEADLESS_H
+
+// The module structs are declared in their own translation units, so the headless tools compile those in directly
+// instead of linking against the plugin library. Only libRack is needed at link time.
+#include "plugin.cpp"
+#include "btfld.cpp"
+#include "btmx.cpp"
+#include "nibbler.cpp"
+
+#include <cmath>
+
+namespace headless {
+
+// Marks a port as patched with the given number of channels. Port::setChannels() is a no-op on disconnected ports,
+// which is what a port is when there is no engine around to plug cables in.
+inline void connect(engine::Port& port, int channels) {
+    port.channels = channels;
+}
+
+inline void connectOutputs(Module* module) {
+    for (auto& output : module->outputs) {
+        connect(output, 1);
+    }
+}
+
+inline void setSampleRate(Module* module, float sampleRate) {
+    Module::SampleRateChangeEvent e;
+    e.sampleRate = sampleRate;
+    e.sampleTime = 1.f / sampleRate;
+    module->onSampleRateChange(e);
+}
+
+// Memory held by one instance of any of the plugin's modules, see the modules' stateBytes()
+inline size_t stateBytes(Module* module) {
+    if (auto btfld = dynamic_cast<Btfld*>(module)) {
+        return btfld->stateBytes();
+    }
+    if (auto btmx = dynamic_cast<BTMX*>(module)) {
+        return btmx->stateBytes();
+    }
+    if (auto nibbler = dynamic_cast<Nibbler*>(module)) {
+        return nibbler->stateBytes();
+    }
+    return sizeof(*module);
+}
+
+inline Module::ProcessArgs processArgs(float sampleRate, int64_t frame) {
+    Module::ProcessArgs args;
+    args.sampleRate = sampleRate;
+    args.sampleTime = 1.f / sampleRate;
+    args.frame = frame;
+    return args;
+}
+
+// Test signals. Channel c is detuned a little so that the polyphonic lanes do not all carry identical data.
+inline float sine(int64_t frame, float sampleRate, float frequency, int channel) {
+    float f = frequency * (1.f + 0.013f * channel);
+    return std::sin(2.f * M_PI * std::fmod(f * frame / sampleRate, 1.f));
+}
+
+inline float gate(int64_t frame, float sampleRate, float frequency, int channel) {
+    float f = frequency * (1.f + 0.013f * channel);
+    return std::fmod(f * frame / sampleRate, 1.f) < 0.5f ? 10.f : 0.f;
+}
+
+}
+
+#endif //SCHLAPPI_VCV_HEADLESS_H
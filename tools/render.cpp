@@ -0,0 +1,408 @@
+// Offline renderer. Runs BTFLD, BTMX or Nibbler over WAV/CSV input files as fast as the CPU allows and writes the
+// outputs to WAV. Independent jobs are spread over a pool of worker threads.
+//
+// Usage: schlappi-render [-j threads] jobfile...
+//
+// A job file holds one or more jobs. Each job starts with a [name] line; a file without any section header is a single
+// job named after the file. Keys, one per line, `#` starts a comment:
+//
+//   module = BTFLD                 module slug (BTFLD, BTMX, Nibbler)
+//   sample_rate = 48000            optional, defaults to the rate of the first WAV input, or 48000
+//   length = 10                    optional length in seconds, defaults to the longest input
+//   scale = 10                     optional volts per WAV full scale, defaults to 10
+//   block = 32                     optional block processing size (8, 16, 32 or 64 frames), the outputs are shifted
+//                                  back by the block latency so that they line up with the inputs
+//   param Gain = 1.3               parameters are matched by their tooltip name or index
+//   input In = drums.wav           WAV channels become polyphony channels; CSV rows are frames, columns channels
+//   output Step = step.wav         one WAV per output, with as many channels as the output has
+//
+// Relative paths are resolved against the directory of the job file.
+
+#include "headless.hpp"
+#include "wav.hpp"
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct PortFile {
+    std::string port;
+    std::string path;
+};
+
+struct Job {
+    std::string name;
+    std::string module;
+    float sampleRate = 0.f;
+    float length = 0.f;
+    float scale = 10.f;
+    int blockSize = 0;
+    std::vector<std::pair<std::string, float>> params;
+    std::vector<PortFile> inputs;
+    std::vector<PortFile> outputs;
+};
+
+struct JobResult {
+    std::string error;
+    int64_t frames = 0;
+    float sampleRate = 0.f;
+    double seconds = 0.0;
+};
+
+static std::string trim(const std::string& s) {
+    auto begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    auto end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+static std::string lower(std::string s) {
+    for (auto& ch : s) {
+        ch = std::tolower(static_cast<unsigned char>(ch));
+    }
+    return s;
+}
+
+static std::string directoryOf(const std::string& path) {
+    auto slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+static std::string resolve(const std::string& directory, const std::string& path) {
+    if (path.empty() || path[0] == '/' || (path.size() > 1 && path[1] == ':')) {
+        return path;
+    }
+    return directory + path;
+}
+
+static std::string parseJobFile(const std::string& path, std::vector<Job>& jobs) {
+    std::ifstream file(path);
+    if (!file) {
+        return "cannot open " + path;
+    }
+    auto directory = directoryOf(path);
+    auto baseName = path.substr(directory.size());
+
+    std::vector<Job> parsed;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        if (line.front() == '[' && line.back() == ']') {
+            parsed.emplace_back();
+            parsed.back().name = trim(line.substr(1, line.size() - 2));
+            continue;
+        }
+        if (parsed.empty()) {
+            parsed.emplace_back();
+            parsed.back().name = baseName;
+        }
+        auto& job = parsed.back();
+
+        auto equals = line.find('=');
+        if (equals == std::string::npos) {
+            return path + ":" + std::to_string(lineNumber) + ": expected `key = value`";
+        }
+        auto key = trim(line.substr(0, equals));
+        auto value = trim(line.substr(equals + 1));
+        auto space = key.find(' ');
+        auto kind = lower(key.substr(0, space));
+        auto name = space == std::string::npos ? "" : trim(key.substr(space + 1));
+
+        if (kind == "module") {
+            job.module = value;
+        } else if (kind == "sample_rate") {
+            job.sampleRate = std::atof(value.c_str());
+        } else if (kind == "length") {
+            job.length = std::atof(value.c_str());
+        } else if (kind == "scale") {
+            job.scale = std::atof(value.c_str());
+        } else if (kind == "block") {
+            job.blockSize = std::atoi(value.c_str());
+        } else if (kind == "param" && !name.empty()) {
+            job.params.push_back({name, static_cast<float>(std::atof(value.c_str()))});
+        } else if (kind == "input" && !name.empty()) {
+            job.inputs.push_back({name, resolve(directory, value)});
+        } else if (kind == "output" && !name.empty()) {
+            job.outputs.push_back({name, resolve(directory, value)});
+        } else {
+            return path + ":" + std::to_string(lineNumber) + ": unknown key `" + key + "`";
+        }
+    }
+    jobs.insert(jobs.end(), parsed.begin(), parsed.end());
+    return "";
+}
+
+static std::string readCsv(const std::string& path, wav::Audio& audio, float scale) {
+    std::ifstream file(path);
+    if (!file) {
+        return "cannot open " + path;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<float> row;
+        std::stringstream cells(line);
+        std::string cell;
+        while (std::getline(cells, cell, ',')) {
+            char* end;
+            auto v = std::strtof(cell.c_str(), &end);
+            if (end == cell.c_str()) {
+                row.clear();
+                break;
+            }
+            // CSV values are volts, stored normalized like WAV samples
+            row.push_back(v / scale);
+        }
+        if (row.empty()) {
+            // header row
+            continue;
+        }
+        if (audio.channels == 0) {
+            audio.channels = row.size();
+        }
+        row.resize(audio.channels, 0.f);
+        audio.samples.insert(audio.samples.end(), row.begin(), row.end());
+    }
+    return audio.channels > 0 ? "" : path + " has no data";
+}
+
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && lower(s.substr(s.size() - suffix.size())) == suffix;
+}
+
+// Finds a param or port by the name it was configured with, or by its index
+template <typename T>
+static int findByName(const std::vector<T*>& infos, const std::string& name) {
+    for (size_t i = 0; i < infos.size(); ++i) {
+        if (infos[i] && lower(infos[i]->name) == lower(name)) {
+            return i;
+        }
+    }
+    char* end;
+    auto index = std::strtol(name.c_str(), &end, 10);
+    if (*end == '\0' && index >= 0 && index < static_cast<long>(infos.size())) {
+        return index;
+    }
+    return -1;
+}
+
+static plugin::Model* findModel(const std::string& slug) {
+    for (auto model : {modelBtfld, modelBTMX, modelNibbler}) {
+        if (lower(model->slug) == lower(slug)) {
+            return model;
+        }
+    }
+    return nullptr;
+}
+
+static JobResult render(const Job& job) {
+    JobResult result;
+    auto model = findModel(job.module);
+    if (!model) {
+        result.error = "unknown module `" + job.module + "`";
+        return result;
+    }
+    std::unique_ptr<Module> module(model->createModule());
+
+    if (job.blockSize != 0) {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "blockSize", json_integer(job.blockSize));
+        BlockSettings settings;
+        settings.fromJson(rootJ);
+        module->dataFromJson(rootJ);
+        json_decref(rootJ);
+        if (settings.size != job.blockSize) {
+            result.error = "block must be 8, 16, 32 or 64";
+            return result;
+        }
+    }
+    // frames the outputs lag behind the inputs
+    int64_t latency = job.blockSize;
+
+    for (auto& param : job.params) {
+        auto id = findByName(module->paramQuantities, param.first);
+        if (id < 0) {
+            result.error = "unknown param `" + param.first + "`";
+            return result;
+        }
+        module->params[id].setValue(param.second);
+    }
+
+    std::vector<std::pair<int, wav::Audio>> inputs;
+    float sampleRate = job.sampleRate;
+    int64_t frames = 0;
+    for (auto& input : job.inputs) {
+        auto id = findByName(module->inputInfos, input.port);
+        if (id < 0) {
+            result.error = "unknown input `" + input.port + "`";
+            return result;
+        }
+        wav::Audio audio;
+        auto error = endsWith(input.path, ".csv") ? readCsv(input.path, audio, job.scale) : wav::read(input.path, audio);
+        if (!error.empty()) {
+            result.error = error;
+            return result;
+        }
+        if (audio.sampleRate > 0.f) {
+            if (sampleRate <= 0.f) {
+                sampleRate = audio.sampleRate;
+            } else if (sampleRate != audio.sampleRate) {
+                result.error = input.path + " does not match the job sample rate";
+                return result;
+            }
+        }
+        audio.channels = std::min(audio.channels, PORT_MAX_CHANNELS);
+        frames = std::max(frames, audio.frames());
+        headless::connect(module->inputs[id], audio.channels);
+        inputs.push_back({id, std::move(audio)});
+    }
+    if (sampleRate <= 0.f) {
+        sampleRate = 48000.f;
+    }
+    if (job.length > 0.f) {
+        frames = static_cast<int64_t>(job.length * sampleRate);
+    }
+    if (frames <= 0) {
+        result.error = "no length given and no inputs to take it from";
+        return result;
+    }
+
+    std::vector<std::pair<int, wav::Audio>> outputs;
+    for (auto& output : job.outputs) {
+        auto id = findByName(module->outputInfos, output.port);
+        if (id < 0) {
+            result.error = "unknown output `" + output.port + "`";
+            return result;
+        }
+        wav::Audio audio;
+        audio.sampleRate = sampleRate;
+        outputs.push_back({id, std::move(audio)});
+    }
+    headless::connectOutputs(module.get());
+    headless::setSampleRate(module.get(), sampleRate);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t frame = 0; frame < frames + latency; ++frame) {
+        for (auto& input : inputs) {
+            auto& audio = input.second;
+            auto& port = module->inputs[input.first];
+            for (auto c = 0; c < audio.channels; ++c) {
+                port.voltages[c] = frame < audio.frames() ? audio.samples[frame * audio.channels + c] * job.scale : 0.f;
+            }
+        }
+        module->process(headless::processArgs(sampleRate, frame));
+        if (frame < latency) {
+            continue;
+        }
+        for (auto& output : outputs) {
+            auto& port = module->outputs[output.first];
+            auto& audio = output.second;
+            if (frame == latency) {
+                // input channel counts are fixed for the whole render, so the outputs are settled after one frame
+                audio.channels = std::max(port.getChannels(), 1);
+                audio.samples.reserve(frames * audio.channels);
+            }
+            for (auto c = 0; c < audio.channels; ++c) {
+                audio.samples.push_back(port.getVoltage(c) / job.scale);
+            }
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.frames = frames;
+    result.sampleRate = sampleRate;
+
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        auto error = wav::write(job.outputs[i].path, outputs[i].second);
+        if (!error.empty()) {
+            result.error = error;
+            return result;
+        }
+    }
+    return result;
+}
+
+static void usage(const char* argv0) {
+    std::fprintf(stderr, "usage: %s [-j threads] jobfile...\n", argv0);
+}
+
+int main(int argc, char** argv) {
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Job> jobs;
+
+    for (auto i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            auto error = parseJobFile(arg, jobs);
+            if (!error.empty()) {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+        }
+    }
+    if (jobs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<JobResult> results(jobs.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            results[i] = render(jobs[i]);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (auto t = 0; t < std::min<int>(threads, jobs.size()); ++t) {
+        pool.emplace_back(worker);
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    double audioSeconds = 0.0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        auto& result = results[i];
+        if (!result.error.empty()) {
+            std::fprintf(stderr, "%s: %s\n", jobs[i].name.c_str(), result.error.c_str());
+            ++failed;
+            continue;
+        }
+        double length = result.frames / result.sampleRate;
+        audioSeconds += length;
+        std::printf("%s: %.2f s of audio in %.2f s (%.1fx realtime)\n",
+                    jobs[i].name.c_str(), length, result.seconds, length / result.seconds);
+    }
+    std::printf("%zu jobs on %d threads: %.2f s of audio in %.2f s wall time\n",
+                jobs.size(), std::min<int>(threads, jobs.size()), audioSeconds, wall);
+    return failed > 0 ? 1 : 0;
+}
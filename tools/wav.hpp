@@ -0,0 +1,147 @@
+#ifndef SCHLAPPI_VCV_WAV_H
+#define SCHLAPPI_VCV_WAV_H
+
+// Minimal RIFF/WAVE reader and writer for the offline renderer. Reads 16/24/32 bit PCM and 32/64 bit float files,
+// always writes 32 bit float.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace wav {
+
+struct Audio {
+    int channels = 0;
+    float sampleRate = 0.f;
+    // interleaved, full scale is +-1
+    std::vector<float> samples;
+
+    int64_t frames() const {
+        return channels > 0 ? samples.size() / channels : 0;
+    }
+};
+
+inline uint32_t readLE(const uint8_t* p, int bytes) {
+    uint32_t v = 0;
+    for (auto i = 0; i < bytes; ++i) {
+        v |= static_cast<uint32_t>(p[i]) << (8 * i);
+    }
+    return v;
+}
+
+inline void writeLE(std::FILE* f, uint32_t v, int bytes) {
+    for (auto i = 0; i < bytes; ++i) {
+        std::fputc((v >> (8 * i)) & 0xff, f);
+    }
+}
+
+/** Returns an empty string on success, otherwise the reason the file could not be read */
+inline std::string read(const std::string& path, Audio& audio) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+        return "cannot open " + path;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[65536];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    std::fclose(f);
+
+    if (data.size() < 12 || std::memcmp(&data[0], "RIFF", 4) != 0 || std::memcmp(&data[8], "WAVE", 4) != 0) {
+        return path + " is not a WAV file";
+    }
+
+    int format = 0, bits = 0;
+    const uint8_t* pcm = nullptr;
+    size_t pcmBytes = 0;
+    for (size_t pos = 12; pos + 8 <= data.size();) {
+        uint32_t size = readLE(&data[pos + 4], 4);
+        const uint8_t* chunk = &data[pos + 8];
+        size = std::min<size_t>(size, data.size() - pos - 8);
+        if (std::memcmp(&data[pos], "fmt ", 4) == 0 && size >= 16) {
+            format = readLE(chunk, 2);
+            audio.channels = readLE(chunk + 2, 2);
+            audio.sampleRate = readLE(chunk + 4, 4);
+            bits = readLE(chunk + 14, 2);
+            if (format == 0xfffe && size >= 26) {
+                // WAVE_FORMAT_EXTENSIBLE, the real format is the first two bytes of the sub format GUID
+                format = readLE(chunk + 24, 2);
+            }
+        } else if (std::memcmp(&data[pos], "data", 4) == 0) {
+            pcm = chunk;
+            pcmBytes = size;
+        }
+        pos += 8 + size + (size & 1);
+    }
+
+    if (!pcm || audio.channels <= 0) {
+        return path + " has no audio data";
+    }
+    int bytes = bits / 8;
+    bool supported = (format == 1 && (bits == 16 || bits == 24 || bits == 32)) ||
+                     (format == 3 && (bits == 32 || bits == 64));
+    if (!supported) {
+        return path + ": unsupported sample format";
+    }
+
+    size_t count = pcmBytes / bytes;
+    count -= count % audio.channels;
+    audio.samples.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* p = pcm + i * bytes;
+        float v;
+        if (format == 3 && bits == 32) {
+            uint32_t u = readLE(p, 4);
+            std::memcpy(&v, &u, 4);
+        } else if (format == 3) {
+            uint64_t u = readLE(p, 4) | (static_cast<uint64_t>(readLE(p + 4, 4)) << 32);
+            double d;
+            std::memcpy(&d, &u, 8);
+            v = d;
+        } else {
+            // sign extend the PCM word to 32 bits
+            int32_t s = static_cast<int32_t>(readLE(p, bytes) << (32 - bits));
+            v = s / 2147483648.f;
+        }
+        audio.samples[i] = v;
+    }
+    return "";
+}
+
+/** Returns an empty string on success, otherwise the reason the file could not be written */
+inline std::string write(const std::string& path, const Audio& audio) {
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) {
+        return "cannot write " + path;
+    }
+    uint32_t dataBytes = audio.samples.size() * 4;
+    std::fwrite("RIFF", 1, 4, f);
+    writeLE(f, 36 + dataBytes, 4);
+    std::fwrite("WAVEfmt ", 1, 8, f);
+    writeLE(f, 16, 4);
+    writeLE(f, 3, 2);
+    writeLE(f, audio.channels, 2);
+    writeLE(f, static_cast<uint32_t>(audio.sampleRate), 4);
+    writeLE(f, static_cast<uint32_t>(audio.sampleRate) * audio.channels * 4, 4);
+    writeLE(f, audio.channels * 4, 2);
+    writeLE(f, 32, 2);
+    std::fwrite("data", 1, 4, f);
+    writeLE(f, dataBytes, 4);
+    for (auto v : audio.samples) {
+        uint32_t u;
+        std::memcpy(&u, &v, 4);
+        writeLE(f, u, 4);
+    }
+    bool ok = !std::ferror(f);
+    std::fclose(f);
+    return ok ? "" : "error writing " + path;
+}
+
+}
+
+#endif //SCHLAPPI_VCV_WAV_H